@@ -0,0 +1,262 @@
+// Statistics of a BMP's pixels, gathered in one pass
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ANALYZE_X86
+#endif
+
+#include "analyze.h"
+
+// Copies of each histogram a thread keeps, so neighbouring pixels rarely wait on the same counter
+#define COPIES 4
+
+// Names of the channels, in stored order
+static const char *CHANNEL_NAMES[] = {"blue", "green", "red", "alpha"};
+
+// One thread's share of the rows, and its tallies
+typedef struct
+{
+    const bitmap *b;
+    int lo;
+    int hi;
+    analysis a;
+    unsigned long long (*histograms)[4][256];
+    bool threaded;
+}
+analyze_job;
+
+// Empties a
+void analysis_init(analysis *a, int colors, const DWORD color[])
+{
+    memset(a, 0, sizeof(analysis));
+    a->colors = colors < MAX_COLORS ? colors : MAX_COLORS;
+    for (int k = 0; k < a->colors; k++)
+    {
+        a->color[k] = color[k] & 0xffffff;
+    }
+}
+
+// Counts pixels from..width of row matching each colour, one pixel at a time
+static void count_scalar(analysis *a, const BYTE *row, int from, int width, int bytes)
+{
+    for (const BYTE *p = row + (size_t) from * bytes, *end = row + (size_t) width * bytes; p < end; p += bytes)
+    {
+        DWORD color = p[0] | p[1] << 8 | (DWORD) p[2] << 16;
+        for (int k = 0; k < a->colors; k++)
+        {
+            a->count[k] += color == a->color[k];
+        }
+    }
+}
+
+#ifdef ANALYZE_X86
+// Counts pixels matching each colour 16 at a time, returning how many pixels were done. Packed 24-bit pixels
+// are shuffled out to one per lane; each 16's last load runs 4 bytes past it, so that's only done
+// while 2 more pixels follow. Lane counts can't overflow, as a row has under 2^24 pixels
+__attribute__((target("ssse3")))
+static int count_ssse3(analysis *a, const BYTE *row, int width, int bytes)
+{
+    const __m128i unpack = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i rgb = _mm_set1_epi32(0xffffff);
+    __m128i counts[MAX_COLORS];
+    for (int k = 0; k < a->colors; k++)
+    {
+        counts[k] = _mm_setzero_si128();
+    }
+
+    int j = 0, step = bytes == 4 ? 4 : 16;
+    for (; bytes == 4 ? j + 4 <= width : j + 18 <= width; j += step)
+    {
+        __m128i v[4];
+        int lanes = bytes == 4 ? 1 : 4;
+        for (int l = 0; l < lanes; l++)
+        {
+            v[l] = bytes == 4 ? _mm_and_si128(_mm_loadu_si128((__m128i *) &row[j * 4]), rgb)
+                   : _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) &row[j * 3 + l * 12]), unpack);
+        }
+        for (int k = 0; k < a->colors; k++)
+        {
+            __m128i color = _mm_set1_epi32(a->color[k]);
+            for (int l = 0; l < lanes; l++)
+            {
+                counts[k] = _mm_sub_epi32(counts[k], _mm_cmpeq_epi32(v[l], color));
+            }
+        }
+    }
+
+    for (int k = 0; k < a->colors; k++)
+    {
+        unsigned int lane[4];
+        _mm_storeu_si128((__m128i *) lane, counts[k]);
+        a->count[k] += (unsigned long long) lane[0] + lane[1] + lane[2] + lane[3];
+    }
+    return j;
+}
+#endif
+
+// Tallies a row: each channel's histogram, spreading pixels over the copies, and the exact colours
+static void tally_row(analyze_job *job, const BYTE *row)
+{
+    int width = job->b->width, bytes = job->b->bytes;
+    const BYTE *p = row;
+    int j = 0;
+    for (; j + COPIES <= width; j += COPIES)
+    {
+        for (int copy = 0; copy < COPIES; copy++, p += bytes)
+        {
+            for (int c = 0; c < bytes; c++)
+            {
+                job->histograms[copy][c][p[c]]++;
+            }
+        }
+    }
+    for (; j < width; j++, p += bytes)
+    {
+        for (int c = 0; c < bytes; c++)
+        {
+            job->histograms[0][c][p[c]]++;
+        }
+    }
+
+    int done = 0;
+#ifdef ANALYZE_X86
+    if (job->a.colors > 0 && __builtin_cpu_supports("ssse3"))
+    {
+        done = count_ssse3(&job->a, row, width, bytes);
+    }
+#endif
+    count_scalar(&job->a, row, done, width, bytes);
+}
+
+// Tallies a thread's rows, then folds its copies of the histograms together
+static void *analyze_rows(void *arg)
+{
+    analyze_job *job = arg;
+    for (int i = job->lo; i < job->hi; i++)
+    {
+        tally_row(job, bmp_row(job->b, i));
+    }
+    for (int copy = 0; copy < COPIES; copy++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            for (int v = 0; v < 256; v++)
+            {
+                job->a.histogram[c][v] += job->histograms[copy][c][v];
+            }
+        }
+    }
+    job->a.pixels = (unsigned long long)(job->hi - job->lo) * job->b->width;
+    return NULL;
+}
+
+// Gathers a's statistics over every pixel of b using threads
+bool analyze(const bitmap *b, analysis *a, int threads)
+{
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (threads > b->height)
+    {
+        threads = b->height;
+    }
+
+    //split the rows into one contiguous chunk per thread, each tallying into its own copy of a
+    analyze_job *jobs = calloc(threads, sizeof(analyze_job));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    bool ok = jobs != NULL && tids != NULL;
+    for (int t = 0; ok && t < threads; t++)
+    {
+        jobs[t].histograms = calloc(COPIES, sizeof(*jobs[t].histograms));
+        ok = jobs[t].histograms != NULL;
+    }
+    for (int t = 0; ok && t < threads; t++)
+    {
+        jobs[t].b = b;
+        jobs[t].lo = (long) b->height * t / threads;
+        jobs[t].hi = (long) b->height * (t + 1) / threads;
+        analysis_init(&jobs[t].a, a->colors, a->color);
+        jobs[t].threaded = t > 0 && pthread_create(&tids[t], NULL, analyze_rows, &jobs[t]) == 0;
+    }
+
+    //this thread takes the first chunk, and any whose thread didn't start, then merges everyone's tallies
+    for (int t = 0; ok && t < threads; t++)
+    {
+        if (jobs[t].threaded)
+        {
+            pthread_join(tids[t], NULL);
+        }
+        else
+        {
+            analyze_rows(&jobs[t]);
+        }
+        a->pixels += jobs[t].a.pixels;
+        for (int c = 0; c < 4; c++)
+        {
+            for (int v = 0; v < 256; v++)
+            {
+                a->histogram[c][v] += jobs[t].a.histogram[c][v];
+            }
+        }
+        for (int k = 0; k < a->colors; k++)
+        {
+            a->count[k] += jobs[t].a.count[k];
+        }
+    }
+
+    for (int t = 0; jobs != NULL && t < threads; t++)
+    {
+        free(jobs[t].histograms);
+    }
+    free(jobs);
+    free(tids);
+    return ok;
+}
+
+// Writes a's statistics of b as JSON
+void analysis_json(FILE *out, const bitmap *b, const analysis *a)
+{
+    fprintf(out, "{\"width\": %i, \"height\": %i, \"bits\": %i, \"top_down\": %s, \"pixels\": %llu, \"channels\": {",
+            b->width, b->height, b->bytes * 8, b->top_down ? "true" : "false", a->pixels);
+
+    //min, max and mean fall out of each histogram
+    for (int c = 0; c < b->bytes; c++)
+    {
+        const unsigned long long *h = a->histogram[c];
+        int min = 0, max = 255;
+        while (min < 255 && h[min] == 0)
+        {
+            min++;
+        }
+        while (max > 0 && h[max] == 0)
+        {
+            max--;
+        }
+        unsigned long long sum = 0;
+        for (int v = 0; v < 256; v++)
+        {
+            sum += h[v] * v;
+        }
+        fprintf(out, "%s\"%s\": {\"min\": %i, \"max\": %i, \"mean\": %.6f, \"histogram\": [", c ? ", " : "",
+                CHANNEL_NAMES[c], a->pixels ? min : 0, a->pixels ? max : 0, a->pixels ? (double) sum / a->pixels : 0);
+        for (int v = 0; v < 256; v++)
+        {
+            fprintf(out, "%s%llu", v ? ", " : "", h[v]);
+        }
+        fprintf(out, "]}");
+    }
+
+    fprintf(out, "}, \"colors\": {");
+    for (int k = 0; k < a->colors; k++)
+    {
+        fprintf(out, "%s\"%06x\": %llu", k ? ", " : "", (unsigned int) a->color[k], a->count[k]);
+    }
+    fprintf(out, "}}\n");
+}
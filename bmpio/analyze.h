@@ -0,0 +1,36 @@
+// Statistics of a BMP's pixels, gathered in one pass
+
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bmpio.h"
+
+// Most exact colours counted at once
+#define MAX_COLORS 16
+
+// Per-channel histograms (blue, green, red, then alpha for 32-bit pixels) and how many pixels
+// were each of the exact colours asked about (0xRRGGBB, ignoring alpha)
+typedef struct
+{
+    unsigned long long pixels;
+    unsigned long long histogram[4][256];
+    int colors;
+    DWORD color[MAX_COLORS];
+    unsigned long long count[MAX_COLORS];
+}
+analysis;
+
+// Empties a, which will count up to MAX_COLORS colours
+void analysis_init(analysis *a, int colors, const DWORD color[]);
+
+// Gathers a's statistics over every pixel of b using threads, each tallying its own rows before they're merged.
+// Returns false if out of memory
+bool analyze(const bitmap *b, analysis *a, int threads);
+
+// Writes a's statistics of b, with min, max and mean per channel, as JSON
+void analysis_json(FILE *out, const bitmap *b, const analysis *a);
+
+#endif // ANALYZE_H
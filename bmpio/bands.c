@@ -0,0 +1,185 @@
+// Renders a resampled (and filtered) BMP in bands of rows across threads
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bands.h"
+
+// Output rows claimed by a thread at a time
+#define BAND 64
+
+// Shared state of the rendering threads
+typedef struct
+{
+    const resample *r;
+    int bands;
+    atomic_int next;
+    atomic_bool ok;
+}
+band_job;
+
+// One thread's buffers: a filtered input row, the input row in floats (with zeroed taps past the edge),
+// a ring of horizontally scaled rows the vertical pass blends, and the blended output row
+typedef struct
+{
+    BYTE *filtered;
+    float *pixels;
+    float **ring;
+    float *blended;
+}
+buffers;
+
+// Frees one thread's buffers
+static void free_buffers(const resample *r, buffers *b)
+{
+    for (int t = 0; b->ring != NULL && t < r->y.taps; t++)
+    {
+        free(b->ring[t]);
+    }
+    free(b->ring);
+    free(b->blended);
+    free(b->pixels);
+    free(b->filtered);
+}
+
+// Allocates one thread's buffers, returns false if out of memory
+static bool alloc_buffers(const resample *r, buffers *b)
+{
+    memset(b, 0, sizeof(buffers));
+    b->filtered = malloc(r->in->stride);
+    b->pixels = calloc((size_t)(r->x.in + r->x.taps) * CHANNELS, sizeof(float));
+    b->blended = malloc((size_t) r->x.out * CHANNELS * sizeof(float));
+    b->ring = calloc(r->y.taps, sizeof(float *));
+    bool ok = b->filtered != NULL && b->pixels != NULL && b->blended != NULL && b->ring != NULL;
+    for (int t = 0; ok && t < r->y.taps; t++)
+    {
+        b->ring[t] = malloc((size_t) r->x.out * CHANNELS * sizeof(float));
+        ok = b->ring[t] != NULL;
+    }
+    if (!ok)
+    {
+        free_buffers(r, b);
+    }
+    return ok;
+}
+
+// Renders output rows lo to hi. The band reads every input row its first output row's taps
+// reach back to, so neighbouring bands overlap by the filter's support and come out
+// exactly as a single pass would
+static void render_band(const resample *r, buffers *b, int lo, int hi)
+{
+    const weights *x = &r->x, *y = &r->y;
+    int in_bytes = r->in->bytes, out_bytes = r->out->bytes;
+    for (int o = lo, next = y->first[lo]; o < hi; o++)
+    {
+        //each input row is filtered and scaled across once, as soon as the first output row needs it;
+        //alpha, if any, rides in the fourth channel
+        int last = y->first[o] + y->taps - 1;
+        for (; next <= last && next < y->in; next++)
+        {
+            const unsigned char *pixel = bmp_row(r->in, next);
+            if (r->before != NULL)
+            {
+                filter_row(r->before, pixel, b->filtered, x->in, in_bytes);
+                pixel = b->filtered;
+            }
+            for (int j = 0; j < x->in; j++, pixel += in_bytes)
+            {
+                for (int c = 0; c < in_bytes; c++)
+                {
+                    b->pixels[j * CHANNELS + c] = pixel[c];
+                }
+            }
+            scale_row(x, b->pixels, b->ring[next % y->taps]);
+        }
+
+        //blend down, then round and clamp back to bytes straight into the output; padding stays zeroed
+        blend_rows(y, o, b->ring, x->out, b->blended);
+        unsigned char *out = bmp_row(r->out, o);
+        for (int j = 0; j < x->out; j++, out += out_bytes)
+        {
+            for (int c = 0; c < out_bytes; c++)
+            {
+                float value = b->blended[j * CHANNELS + c];
+                out[c] = value <= 0 ? 0 : value >= 255 ? 255 : (BYTE) lrintf(value);
+            }
+        }
+        if (r->after != NULL)
+        {
+            filter_row(r->after, bmp_row(r->out, o), bmp_row(r->out, o), x->out, out_bytes);
+        }
+    }
+}
+
+// Renders bands claimed one at a time from the shared job
+static void *band_worker(void *arg)
+{
+    band_job *job = arg;
+    buffers b;
+    if (!alloc_buffers(job->r, &b))
+    {
+        atomic_store(&job->ok, false);
+        return NULL;
+    }
+    int i;
+    while (atomic_load(&job->ok) && (i = atomic_fetch_add(&job->next, 1)) < job->bands)
+    {
+        int lo = i * BAND;
+        int hi = lo + BAND < job->r->y.out ? lo + BAND : job->r->y.out;
+        render_band(job->r, &b, lo, hi);
+    }
+    free_buffers(job->r, &b);
+    return NULL;
+}
+
+// Renders every output row of r using threads
+bool resample_bands(const resample *r, int threads)
+{
+    band_job job = {.r = r, .bands = (r->y.out + BAND - 1) / BAND};
+    atomic_init(&job.next, 0);
+    atomic_init(&job.ok, true);
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (threads > job.bands)
+    {
+        threads = job.bands;
+    }
+
+    //one thread renders on this one, with no pool to start
+    if (threads == 1)
+    {
+        band_worker(&job);
+        return atomic_load(&job.ok);
+    }
+
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if (tids == NULL)
+    {
+        return false;
+    }
+    //workers claim bands one at a time, so fewer threads than asked for just render more each,
+    //and if none start this thread renders them all
+    int started = 0;
+    while (started < threads && pthread_create(&tids[started], NULL, band_worker, &job) == 0)
+    {
+        started++;
+    }
+    if (started == 0)
+    {
+        band_worker(&job);
+    }
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    return atomic_load(&job.ok);
+}
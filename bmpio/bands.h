@@ -0,0 +1,29 @@
+// Renders a resampled (and filtered) BMP in bands of rows across threads
+
+#ifndef BANDS_H
+#define BANDS_H
+
+#include <stdbool.h>
+
+#include "bmpio.h"
+#include "filters.h"
+#include "scale.h"
+
+// The mapped images a resize reads its pixels from and writes them to, with a weight table
+// per axis and the filters (or NULL) run on each row before and after it's resampled.
+// Rows are addressed in place, so any band can be rendered independently of the others
+typedef struct
+{
+    const bitmap *in;
+    bitmap *out;
+    weights x;
+    weights y;
+    const pixel_filter *before;
+    const pixel_filter *after;
+}
+resample;
+
+// Renders every output row of r using threads, each claiming bands of rows and writing them in place
+bool resample_bands(const resample *r, int threads);
+
+#endif // BANDS_H
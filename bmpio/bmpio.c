@@ -0,0 +1,191 @@
+// Memory-mapped reading and writing of BMP files
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bmpio.h"
+
+// Compression values for plain pixels, and for 32-bit pixels described by channel masks
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+// Largest width or height accepted, which keeps every offset well inside a size_t
+#define MAX_SIDE (1 << 24)
+
+// Bytes in a row of width pixels of bytes each, padded to a multiple of four
+static size_t row_stride(int width, int bytes)
+{
+    return ((size_t) width * bytes + 3) / 4 * 4;
+}
+
+// Returns true if b's headers describe pixels this module can read
+static bool supported(const bitmap *b)
+{
+    const BITMAPFILEHEADER *bf = &b->bf;
+    const BITMAPINFOHEADER *bi = &b->bi;
+    if (bf->bfType != 0x4d42 || bi->biSize < sizeof(BITMAPINFOHEADER) ||
+        bf->bfOffBits < sizeof(BITMAPFILEHEADER) + bi->biSize)
+    {
+        return false;
+    }
+    if (bi->biWidth <= 0 || bi->biWidth > MAX_SIDE || bi->biHeight == 0 ||
+        bi->biHeight < -MAX_SIDE || bi->biHeight > MAX_SIDE)
+    {
+        return false;
+    }
+
+    //32-bit pixels may come with masks, but only the usual BGRA order is read
+    if (bi->biBitCount == 24)
+    {
+        return bi->biCompression == BI_RGB;
+    }
+    if (bi->biBitCount == 32 && bi->biCompression == BI_BITFIELDS)
+    {
+        const DWORD bgra[] = {0x00ff0000, 0x0000ff00, 0x000000ff};
+        size_t masks = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+        return bf->bfOffBits >= masks + sizeof(bgra) && b->size >= masks + sizeof(bgra) &&
+               memcmp(b->data + masks, bgra, sizeof(bgra)) == 0;
+    }
+    return bi->biBitCount == 32 && bi->biCompression == BI_RGB;
+}
+
+// Maps the BMP at path for reading
+bmp_status bmp_open(bitmap *b, const char *path)
+{
+    memset(b, 0, sizeof(bitmap));
+    b->fd = open(path, O_RDONLY);
+    if (b->fd < 0)
+    {
+        return BMP_UNREADABLE;
+    }
+
+    struct stat st;
+    if (fstat(b->fd, &st) != 0)
+    {
+        close(b->fd);
+        return BMP_UNREADABLE;
+    }
+    b->size = st.st_size;
+    if (b->size < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER))
+    {
+        close(b->fd);
+        return BMP_UNSUPPORTED;
+    }
+    b->data = mmap(NULL, b->size, PROT_READ, MAP_PRIVATE, b->fd, 0);
+    if (b->data == MAP_FAILED)
+    {
+        close(b->fd);
+        return BMP_UNREADABLE;
+    }
+    memcpy(&b->bf, b->data, sizeof(BITMAPFILEHEADER));
+    memcpy(&b->bi, b->data + sizeof(BITMAPFILEHEADER), sizeof(BITMAPINFOHEADER));
+
+    //every row has to be in the file, so views into it never run off the end
+    if (!supported(b))
+    {
+        bmp_close(b);
+        return BMP_UNSUPPORTED;
+    }
+    b->width = b->bi.biWidth;
+    b->height = abs(b->bi.biHeight);
+    b->top_down = b->bi.biHeight < 0;
+    b->bytes = b->bi.biBitCount / 8;
+    b->stride = row_stride(b->width, b->bytes);
+    if (b->bf.bfOffBits > b->size || (b->size - b->bf.bfOffBits) / b->stride < (size_t) b->height)
+    {
+        bmp_close(b);
+        return BMP_UNSUPPORTED;
+    }
+    b->pixels = b->data + b->bf.bfOffBits;
+    madvise(b->data, b->size, MADV_SEQUENTIAL);
+    return BMP_OK;
+}
+
+// Creates a BMP at path mapped for writing
+bmp_status bmp_create(bitmap *b, const char *path, int width, int height, bool top_down, int bytes,
+                      const bitmap *like)
+{
+    memset(b, 0, sizeof(bitmap));
+    if (width <= 0 || width > MAX_SIDE || height <= 0 || height > MAX_SIDE || (bytes != 3 && bytes != 4))
+    {
+        return BMP_UNSUPPORTED;
+    }
+    b->width = width;
+    b->height = height;
+    b->top_down = top_down;
+    b->bytes = bytes;
+    b->stride = row_stride(width, bytes);
+
+    //headers keep like's resolution and palette fields, with a plain 40-byte info header
+    if (like != NULL)
+    {
+        b->bf = like->bf;
+        b->bi = like->bi;
+    }
+    b->bf.bfType = 0x4d42;
+    b->bf.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+    b->bi.biSize = sizeof(BITMAPINFOHEADER);
+    b->bi.biWidth = width;
+    b->bi.biHeight = top_down ? -height : height;
+    b->bi.biPlanes = 1;
+    b->bi.biBitCount = bytes * 8;
+    b->bi.biCompression = BI_RGB;
+
+    //the file's size is worked out in a size_t, and a file too big for the headers' 32-bit size fields is refused
+    size_t image = b->stride * height;
+    b->size = b->bf.bfOffBits + image;
+    if (b->size > UINT32_MAX)
+    {
+        return BMP_UNSUPPORTED;
+    }
+    b->bi.biSizeImage = image;
+    b->bf.bfSize = b->size;
+
+    //the whole file is allocated up front so every row already has its place, and a full disk
+    //shows up here rather than as a fault while pixels are being written
+    b->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (b->fd < 0)
+    {
+        return BMP_UNWRITABLE;
+    }
+    if (posix_fallocate(b->fd, 0, b->size) != 0)
+    {
+        close(b->fd);
+        return BMP_UNWRITABLE;
+    }
+    b->data = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED, b->fd, 0);
+    if (b->data == MAP_FAILED)
+    {
+        close(b->fd);
+        return BMP_UNWRITABLE;
+    }
+    memcpy(b->data, &b->bf, sizeof(BITMAPFILEHEADER));
+    memcpy(b->data + sizeof(BITMAPFILEHEADER), &b->bi, sizeof(BITMAPINFOHEADER));
+    b->pixels = b->data + b->bf.bfOffBits;
+    return BMP_OK;
+}
+
+// Unmaps a BMP and closes its file
+bool bmp_close(bitmap *b)
+{
+    bool ok = munmap(b->data, b->size) == 0;
+    return close(b->fd) == 0 && ok;
+}
+
+// Asks the kernel to start reading the file at path into the page cache
+void bmp_prefetch(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
@@ -0,0 +1,65 @@
+// Memory-mapped reading and writing of BMP files
+
+#ifndef BMPIO_H
+#define BMPIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bmp.h"
+
+// Why a BMP couldn't be opened, numbered as the tools' exit codes
+typedef enum
+{
+    BMP_OK = 0,
+    BMP_UNREADABLE = 2,
+    BMP_UNWRITABLE = 3,
+    BMP_UNSUPPORTED = 4
+}
+bmp_status;
+
+// An uncompressed 24-bit BGR or 32-bit BGRA BMP mapped into memory. Rows are kept in the
+// order they're stored in, bottom-up unless top_down, each stride bytes apart with any padding
+typedef struct
+{
+    int fd;
+    unsigned char *data;
+    size_t size;
+    BITMAPFILEHEADER bf;
+    BITMAPINFOHEADER bi;
+    int width;
+    int height;
+    bool top_down;
+    int bytes;
+    size_t stride;
+    unsigned char *pixels;
+}
+bitmap;
+
+// Maps the BMP at path for reading, checking its headers once
+bmp_status bmp_open(bitmap *b, const char *path);
+
+// Creates a width by height BMP at path with bytes per pixel, stored top_down or not, mapped for writing.
+// Headers are copied from like, if any, with the size fields updated; pixels and padding start zeroed
+bmp_status bmp_create(bitmap *b, const char *path, int width, int height, bool top_down, int bytes,
+                      const bitmap *like);
+
+// Unmaps a BMP and closes its file, returns false if written pixels couldn't be saved
+bool bmp_close(bitmap *b);
+
+// Asks the kernel to start reading the file at path into the page cache, ahead of bmp_open
+void bmp_prefetch(const char *path);
+
+// Returns the stored row i of b (0 is the bottom row unless b is top-down)
+static inline unsigned char *bmp_row(const bitmap *b, int i)
+{
+    return b->pixels + (size_t) i * b->stride;
+}
+
+// Returns pixel j of stored row i of b, its blue, green, red (and alpha) bytes in order
+static inline unsigned char *bmp_pixel(const bitmap *b, int i, int j)
+{
+    return bmp_row(b, i) + (size_t) j * b->bytes;
+}
+
+#endif // BMPIO_H
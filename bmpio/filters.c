@@ -0,0 +1,428 @@
+// Per-pixel filters run a row at a time over BMP pixels
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTERS_X86
+#endif
+
+#include "filters.h"
+
+// Weights of blue, green and red in a pixel's brightness (BT.601, out of 256)
+static const int LUMA_WEIGHTS[3] = {29, 150, 77};
+
+// Level threshold splits pixels at by default
+#define THRESHOLD 128
+
+// Empties a filter
+void filter_init(pixel_filter *f)
+{
+    f->count = 0;
+}
+
+// Returns the next free stage of f, cleared and of kind, or NULL if f is full
+static stage *push_stage(pixel_filter *f, stage_kind kind)
+{
+    if (f->count == MAX_STAGES)
+    {
+        return NULL;
+    }
+    stage *s = &f->stages[f->count++];
+    memset(s, 0, sizeof(stage));
+    s->kind = kind;
+    return s;
+}
+
+// Appends a stage replacing exact colours
+bool add_keys(pixel_filter *f, int keys, const DWORD from[], const DWORD to[])
+{
+    stage *s = keys > 0 && keys <= MAX_KEYS ? push_stage(f, KEY) : NULL;
+    if (s == NULL)
+    {
+        return false;
+    }
+    s->keys = keys;
+    for (int k = 0; k < keys; k++)
+    {
+        s->from[k] = from[k] & 0xffffff;
+        s->to[k] = to[k] & 0xffffff;
+    }
+    return true;
+}
+
+// Appends a stage mapping each channel through a table
+bool add_lut(pixel_filter *f, const BYTE lut[3][256])
+{
+    //back-to-back tables compose into one, so chains of them cost a single lookup
+    if (f->count > 0 && f->stages[f->count - 1].kind == LUT)
+    {
+        stage *s = &f->stages[f->count - 1];
+        for (int c = 0; c < 3; c++)
+        {
+            for (int v = 0; v < 256; v++)
+            {
+                s->lut[c][v] = lut[c][s->lut[c][v]];
+            }
+        }
+        return true;
+    }
+    stage *s = push_stage(f, LUT);
+    if (s == NULL)
+    {
+        return false;
+    }
+    memcpy(s->lut, lut, sizeof(s->lut));
+    return true;
+}
+
+// Appends a stage calling transform on every pixel
+bool add_transform(pixel_filter *f, void (*transform)(BYTE *pixel, void *arg), void *arg)
+{
+    stage *s = push_stage(f, CUSTOM);
+    if (s == NULL)
+    {
+        return false;
+    }
+    s->transform = transform;
+    s->arg = arg;
+    return true;
+}
+
+// Appends a stage reordering channels
+static bool add_swap(pixel_filter *f, const int order[3])
+{
+    stage *s = push_stage(f, SWAP);
+    if (s == NULL)
+    {
+        return false;
+    }
+    memcpy(s->order, order, sizeof(s->order));
+    return true;
+}
+
+// Appends a stage turning pixels gray
+static bool add_luma(pixel_filter *f)
+{
+    stage *s = push_stage(f, LUMA);
+    if (s == NULL)
+    {
+        return false;
+    }
+    memcpy(s->weight, LUMA_WEIGHTS, sizeof(s->weight));
+    return true;
+}
+
+// Parses a channel order like rgb into the stored channel each of blue, green and red comes from
+static bool parse_order(const char *s, int order[3])
+{
+    if (strlen(s) != 3)
+    {
+        return false;
+    }
+    bool used[3] = {false};
+    for (int c = 0; c < 3; c++)
+    {
+        const char *channel = strchr("bgr", s[c]);
+        if (s[c] == '\0' || channel == NULL || used[channel - "bgr"])
+        {
+            return false;
+        }
+        order[c] = channel - "bgr";
+        used[order[c]] = true;
+    }
+    return true;
+}
+
+// Appends a built-in filter described by spec
+bool add_filter(pixel_filter *f, const char *spec)
+{
+    const char *value = strchr(spec, '=');
+    size_t name = value ? (size_t)(value - spec) : strlen(spec);
+    value = value ? value + 1 : NULL;
+    BYTE lut[3][256];
+
+    //whodunit's: pure red noise and white background go black, leaving the message
+    if (strncmp(spec, "reveal", name) == 0 && name == 6 && value == NULL)
+    {
+        const DWORD from[] = {0xff0000, 0xffffff};
+        const DWORD to[] = {0x000000, 0x000000};
+        return add_keys(f, 2, from, to);
+    }
+    if (strncmp(spec, "grayscale", name) == 0 && name == 9 && value == NULL)
+    {
+        return add_luma(f);
+    }
+
+    //gray first, then everything at or above level goes white and the rest black
+    if (strncmp(spec, "threshold", name) == 0 && name == 9)
+    {
+        char *end;
+        long level = value ? strtol(value, &end, 10) : THRESHOLD;
+        if (value != NULL && (*end != '\0' || end == value || level < 0 || level > 256))
+        {
+            return false;
+        }
+        for (int v = 0; v < 256; v++)
+        {
+            lut[0][v] = lut[1][v] = lut[2][v] = v >= level ? 0xff : 0x00;
+        }
+        return f->count + 2 <= MAX_STAGES && add_luma(f) && add_lut(f, lut);
+    }
+    if (strncmp(spec, "swap", name) == 0 && name == 4 && value != NULL)
+    {
+        int order[3];
+        return parse_order(value, order) && add_swap(f, order);
+    }
+
+    //each channel scales by the tint's, so white becomes the tint and black stays black
+    if (strncmp(spec, "tint", name) == 0 && name == 4 && value != NULL)
+    {
+        char *end;
+        unsigned long color = strtoul(value, &end, 16);
+        if (*end != '\0' || end - value != 6)
+        {
+            return false;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            int scale = (color >> (8 * c)) & 0xff;
+            for (int v = 0; v < 256; v++)
+            {
+                lut[c][v] = (v * scale + 127) / 255;
+            }
+        }
+        return add_lut(f, lut);
+    }
+    return false;
+}
+
+// Returns true if stage s works on whole pixels held in vector lanes
+static bool vector_stage(const stage *s)
+{
+    return s->kind == KEY || s->kind == SWAP || s->kind == LUMA;
+}
+
+// Applies stage s to one pixel
+static void stage_pixel(const stage *s, BYTE *p)
+{
+    switch (s->kind)
+    {
+        case KEY:
+        {
+            DWORD color = p[0] | p[1] << 8 | (DWORD) p[2] << 16;
+            for (int k = 0; k < s->keys; k++)
+            {
+                if (color == s->from[k])
+                {
+                    p[0] = s->to[k];
+                    p[1] = s->to[k] >> 8;
+                    p[2] = s->to[k] >> 16;
+                    break;
+                }
+            }
+            break;
+        }
+
+        case SWAP:
+        {
+            BYTE copy[3] = {p[0], p[1], p[2]};
+            for (int c = 0; c < 3; c++)
+            {
+                p[c] = copy[s->order[c]];
+            }
+            break;
+        }
+
+        case LUMA:
+            p[0] = p[1] = p[2] = (s->weight[0] * p[0] + s->weight[1] * p[1] + s->weight[2] * p[2] + 128) >> 8;
+            break;
+
+        case LUT:
+            p[0] = s->lut[0][p[0]];
+            p[1] = s->lut[1][p[1]];
+            p[2] = s->lut[2][p[2]];
+            break;
+
+        case CUSTOM:
+            s->transform(p, s->arg);
+            break;
+    }
+}
+
+// Applies stages lo to hi to pixels from..width of row, one pixel at a time
+static void stages_scalar(const pixel_filter *f, int lo, int hi, BYTE *row, int from, int width, int bytes)
+{
+    for (BYTE *p = row + (size_t) from * bytes, *end = row + (size_t) width * bytes; p < end; p += bytes)
+    {
+        for (int i = lo; i < hi; i++)
+        {
+            stage_pixel(&f->stages[i], p);
+        }
+    }
+}
+
+// Applies table stage s to a whole row, one byte at a time
+static void lut_row(const stage *s, BYTE *row, int width, int bytes)
+{
+    for (BYTE *p = row, *end = row + (size_t) width * bytes; p < end; p += bytes)
+    {
+        p[0] = s->lut[0][p[0]];
+        p[1] = s->lut[1][p[1]];
+        p[2] = s->lut[2][p[2]];
+    }
+}
+
+#ifdef FILTERS_X86
+// Applies vector stage s to four pixels, one per 32-bit lane as blue, green, red, alpha
+__attribute__((target("ssse3")))
+static __m128i stage_lanes(const stage *s, __m128i v)
+{
+    const __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+    switch (s->kind)
+    {
+        //lanes are replaced by the first key they match, comparing without alpha
+        case KEY:
+        {
+            __m128i color = _mm_andnot_si128(alpha, v);
+            __m128i done = _mm_setzero_si128();
+            __m128i out = v;
+            for (int k = 0; k < s->keys; k++)
+            {
+                __m128i match = _mm_andnot_si128(done, _mm_cmpeq_epi32(color, _mm_set1_epi32(s->from[k])));
+                __m128i to = _mm_or_si128(_mm_set1_epi32(s->to[k]), _mm_and_si128(v, alpha));
+                out = _mm_or_si128(_mm_andnot_si128(match, out), _mm_and_si128(match, to));
+                done = _mm_or_si128(done, match);
+            }
+            return out;
+        }
+
+        case SWAP:
+        {
+            char o0 = s->order[0], o1 = s->order[1], o2 = s->order[2];
+            return _mm_shuffle_epi8(v, _mm_setr_epi8(o0, o1, o2, 3, 4 + o0, 4 + o1, 4 + o2, 7,
+                                                     8 + o0, 8 + o1, 8 + o2, 11, 12 + o0, 12 + o1, 12 + o2, 15));
+        }
+
+        //widen to 16 bits, weigh and add pairs, then add across to get each pixel's mix
+        case LUMA:
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i weights = _mm_setr_epi16(s->weight[0], s->weight[1], s->weight[2], 0,
+                                             s->weight[0], s->weight[1], s->weight[2], 0);
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights);
+            __m128i gray = _mm_srli_epi32(_mm_add_epi32(_mm_hadd_epi32(lo, hi), _mm_set1_epi32(128)), 8);
+            gray = _mm_shuffle_epi8(gray, _mm_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1));
+            return _mm_or_si128(gray, _mm_and_si128(v, alpha));
+        }
+
+        default:
+            return v;
+    }
+}
+
+// Applies vector stages lo to hi to row 16 pixels at a time, returning how many pixels were done.
+// Packed 24-bit pixels are shuffled out to one per lane and back; the last load and store of each
+// 16 run 4 bytes past it, so that's only done while 2 more pixels follow
+__attribute__((target("ssse3")))
+static int stages_ssse3(const pixel_filter *f, int lo, int hi, BYTE *row, int width, int bytes)
+{
+    const __m128i unpack = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i tail = _mm_setr_epi32(0, 0, 0, -1);
+    int j = 0;
+    if (bytes == 4)
+    {
+        for (; j + 4 <= width; j += 4)
+        {
+            __m128i v = _mm_loadu_si128((__m128i *) &row[j * 4]);
+            for (int i = lo; i < hi; i++)
+            {
+                v = stage_lanes(&f->stages[i], v);
+            }
+            _mm_storeu_si128((__m128i *) &row[j * 4], v);
+        }
+        return j;
+    }
+    for (; j + 18 <= width; j += 16)
+    {
+        BYTE *p = &row[j * 3];
+        __m128i in[4], v[4];
+        for (int k = 0; k < 4; k++)
+        {
+            in[k] = _mm_loadu_si128((__m128i *) &p[k * 12]);
+            v[k] = _mm_shuffle_epi8(in[k], unpack);
+        }
+        for (int i = lo; i < hi; i++)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                v[k] = stage_lanes(&f->stages[i], v[k]);
+            }
+        }
+
+        //each store's last 4 bytes are put back as loaded, then overwritten by the next store
+        for (int k = 0; k < 4; k++)
+        {
+            __m128i out = _mm_or_si128(_mm_shuffle_epi8(v[k], pack), _mm_and_si128(in[k], tail));
+            _mm_storeu_si128((__m128i *) &p[k * 12], out);
+        }
+    }
+    return j;
+}
+#endif
+
+// Applies vector stages lo to hi to a whole row, with SSSE3 when the CPU has it
+static void stages_row(const pixel_filter *f, int lo, int hi, BYTE *row, int width, int bytes)
+{
+    int done = 0;
+#ifdef FILTERS_X86
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        done = stages_ssse3(f, lo, hi, row, width, bytes);
+    }
+#endif
+    stages_scalar(f, lo, hi, row, done, width, bytes);
+}
+
+// Filters a row of width pixels from in to out
+void filter_row(const pixel_filter *f, const BYTE *in, BYTE *out, int width, int bytes)
+{
+    //stages run in place on out, which stays in cache while the row passes through them all
+    if (in != out)
+    {
+        memcpy(out, in, (size_t) width * bytes);
+    }
+
+    //runs of vector stages share one trip through the lanes
+    for (int i = 0; i < f->count;)
+    {
+        const stage *s = &f->stages[i];
+        if (vector_stage(s))
+        {
+            int hi = i;
+            while (hi < f->count && vector_stage(&f->stages[hi]))
+            {
+                hi++;
+            }
+            stages_row(f, i, hi, out, width, bytes);
+            i = hi;
+        }
+        else
+        {
+            if (s->kind == LUT)
+            {
+                lut_row(s, out, width, bytes);
+            }
+            else
+            {
+                stages_scalar(f, i, i + 1, out, 0, width, bytes);
+            }
+            i++;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+// Per-pixel filters run a row at a time over BMP pixels
+
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include <stdbool.h>
+
+#include "bmpio.h"
+
+// Most colours a single key stage replaces, and most stages a filter chains
+#define MAX_KEYS 8
+#define MAX_STAGES 16
+
+// Kinds of stage: replacing exact colours, reordering channels, mixing channels into gray,
+// mapping each channel through a table, or calling a function on each pixel
+typedef enum
+{
+    KEY,
+    SWAP,
+    LUMA,
+    LUT,
+    CUSTOM
+}
+stage_kind;
+
+// One step of a filter. Colours are 0xRRGGBB, channels are numbered in stored order
+// (0 blue, 1 green, 2 red), and alpha is always left as it is
+typedef struct
+{
+    stage_kind kind;
+
+    //KEY: pixels of colour from[k] become to[k], the first match winning
+    int keys;
+    DWORD from[MAX_KEYS];
+    DWORD to[MAX_KEYS];
+
+    //SWAP: channel c takes the value of channel order[c]
+    int order[3];
+
+    //LUMA: every channel becomes the mix of blue, green and red by weight (out of 256)
+    int weight[3];
+
+    //LUT: channel c's value v becomes lut[c][v]
+    BYTE lut[3][256];
+
+    //CUSTOM: transform(pixel, arg) is called with each pixel's blue, green and red bytes
+    void (*transform)(BYTE *pixel, void *arg);
+    void *arg;
+}
+stage;
+
+// Stages applied in order to every pixel
+typedef struct
+{
+    int count;
+    stage stages[MAX_STAGES];
+}
+pixel_filter;
+
+// Empties a filter
+void filter_init(pixel_filter *f);
+
+// Appends a built-in filter described by spec: reveal, grayscale, threshold[=level],
+// swap=order (e.g. swap=rgb, naming the channels to store blue, green, red from) or tint=RRGGBB.
+// Returns false if spec is unknown or the filter is full
+bool add_filter(pixel_filter *f, const char *spec);
+
+// Appends a stage replacing up to MAX_KEYS exact colours
+bool add_keys(pixel_filter *f, int keys, const DWORD from[], const DWORD to[]);
+
+// Appends a stage mapping each channel through a table, folding it into a table stage just before
+bool add_lut(pixel_filter *f, const BYTE lut[3][256]);
+
+// Appends a stage calling transform on every pixel
+bool add_transform(pixel_filter *f, void (*transform)(BYTE *pixel, void *arg), void *arg);
+
+// Filters a row of width pixels of bytes each (3 or 4) from in to out, which may be the same row
+void filter_row(const pixel_filter *f, const BYTE *in, BYTE *out, int width, int bytes);
+
+#endif // FILTERS_H
@@ -0,0 +1,296 @@
+// Separable resampling filters for resizing BMP rows
+
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCALE_X86
+#endif
+
+#include "scale.h"
+
+// Radius of each filter's kernel, in input pixels at scale 1
+static const double RADIUS[] = {0.5, 1.0, 2.0, 3.0};
+
+// Returns sin(pi x) / (pi x)
+static double sinc(double x)
+{
+    if (x == 0)
+    {
+        return 1;
+    }
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+// Evaluates filter f's kernel at distance x
+static double kernel(filter f, double x)
+{
+    double d = fabs(x);
+    switch (f)
+    {
+        //the pixel whose centre is closest, the one to the right on a tie
+        case NEAREST:
+            return x > -0.5 && x <= 0.5;
+
+        case BILINEAR:
+            return d < 1 ? 1 - d : 0;
+
+        // Catmull-Rom (a = -0.5)
+        case BICUBIC:
+            if (d < 1)
+            {
+                return (1.5 * d - 2.5) * d * d + 1;
+            }
+            if (d < 2)
+            {
+                return ((-0.5 * d + 2.5) * d - 4) * d + 2;
+            }
+            return 0;
+
+        case LANCZOS:
+            return d < 3 ? sinc(d) * sinc(d / 3) : 0;
+    }
+    return 0;
+}
+
+// Parses a filter name
+bool parse_filter(const char *name, filter *f)
+{
+    const char *names[] = {"nearest", "bilinear", "bicubic", "lanczos"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *f = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses a scale factor
+bool parse_factor(const char *s, double *fx, double *fy)
+{
+    char *end;
+    *fx = strtod(s, &end);
+    *fy = *fx;
+    if (*end == 'x')
+    {
+        *fy = strtod(end + 1, &end);
+    }
+    return *end == '\0' && end != s && *fx > 0 && *fy > 0;
+}
+
+// Returns size scaled by factor, never less than one pixel (nor more than fit an int)
+int scaled_size(int size, double factor)
+{
+    double scaled = round(size * factor);
+    return scaled < 1 ? 1 : scaled > INT_MAX ? INT_MAX : (int) scaled;
+}
+
+// Builds the weight table for scaling in pixels to out with filter f
+bool make_weights(weights *w, int in, int out, filter f)
+{
+    //when shrinking, the kernel widens to cover every input pixel that falls in an output pixel
+    //(except nearest, which still picks just one)
+    double scale = (double) out / in;
+    double stretch = scale < 1 && f != NEAREST ? 1 / scale : 1;
+    double support = RADIUS[f] * stretch;
+
+    w->in = in;
+    w->out = out;
+    w->taps = (int) ceil(support) * 2 + 1;
+    w->first = malloc(out * sizeof(int));
+    w->weights = calloc((size_t) out * w->taps, sizeof(float));
+    if (w->first == NULL || w->weights == NULL)
+    {
+        free_weights(w);
+        return false;
+    }
+
+    for (int o = 0; o < out; o++)
+    {
+        //pixel centres line up across the two sizes
+        double centre = (o + 0.5) / scale - 0.5;
+        int lo = (int) floor(centre - support) + 1;
+        int hi = (int) floor(centre + support);
+        if (lo < 0)
+        {
+            lo = 0;
+        }
+        if (hi > in - 1)
+        {
+            hi = in - 1;
+        }
+        if (hi - lo + 1 > w->taps)
+        {
+            hi = lo + w->taps - 1;
+        }
+
+        //weights over the taps inside the image, normalized to sum to one
+        float *row = &w->weights[(size_t) o * w->taps];
+        double sum = 0;
+        for (int i = lo; i <= hi; i++)
+        {
+            row[i - lo] = kernel(f, (i - centre) / stretch);
+            sum += row[i - lo];
+        }
+        for (int i = lo; sum != 0 && i <= hi; i++)
+        {
+            row[i - lo] /= sum;
+        }
+        w->first[o] = lo;
+    }
+    return true;
+}
+
+// Frees a weight table
+void free_weights(weights *w)
+{
+    free(w->first);
+    free(w->weights);
+    w->first = NULL;
+    w->weights = NULL;
+}
+
+// Accumulates each output pixel's taps one pixel (four channels) at a time
+static void scale_row_scalar(const weights *w, const float *in, float *out)
+{
+    for (int o = 0; o < w->out; o++)
+    {
+        const float *weight = &w->weights[(size_t) o * w->taps];
+        const float *pixel = &in[w->first[o] * CHANNELS];
+        float sum[CHANNELS] = {0};
+        for (int t = 0; t < w->taps; t++)
+        {
+            for (int c = 0; c < CHANNELS; c++)
+            {
+                sum[c] += weight[t] * pixel[t * CHANNELS + c];
+            }
+        }
+        memcpy(&out[o * CHANNELS], sum, sizeof(sum));
+    }
+}
+
+// Weighs each tapped row in turn across the whole output row
+static void blend_rows_scalar(const weights *w, int o, float **rows, int width, float *out)
+{
+    const float *weight = &w->weights[(size_t) o * w->taps];
+    int n = width * CHANNELS;
+    memset(out, 0, n * sizeof(float));
+    for (int t = 0; t < w->taps; t++)
+    {
+        if (weight[t] == 0)
+        {
+            continue;
+        }
+        const float *row = rows[(w->first[o] + t) % w->taps];
+        for (int i = 0; i < n; i++)
+        {
+            out[i] += weight[t] * row[i];
+        }
+    }
+}
+
+#ifdef SCALE_X86
+// Accumulates two output pixels at once, one per 128-bit lane
+__attribute__((target("avx2,fma")))
+static void scale_row_avx2(const weights *w, const float *in, float *out)
+{
+    int o = 0;
+    for (; o + 2 <= w->out; o += 2)
+    {
+        const float *w0 = &w->weights[(size_t) o * w->taps];
+        const float *w1 = w0 + w->taps;
+        const float *p0 = &in[w->first[o] * CHANNELS];
+        const float *p1 = &in[w->first[o + 1] * CHANNELS];
+        __m256 sum = _mm256_setzero_ps();
+        for (int t = 0; t < w->taps; t++)
+        {
+            __m256 pixels = _mm256_set_m128(_mm_loadu_ps(p1 + t * CHANNELS), _mm_loadu_ps(p0 + t * CHANNELS));
+            __m256 weight = _mm256_set_m128(_mm_set1_ps(w1[t]), _mm_set1_ps(w0[t]));
+            sum = _mm256_fmadd_ps(pixels, weight, sum);
+        }
+        _mm256_storeu_ps(&out[o * CHANNELS], sum);
+    }
+
+    //an odd last pixel goes through the scalar path
+    if (o < w->out)
+    {
+        weights last = *w;
+        last.out = 1;
+        last.first = &w->first[o];
+        last.weights = &w->weights[(size_t) o * w->taps];
+        scale_row_scalar(&last, in, &out[o * CHANNELS]);
+    }
+}
+
+// Weighs each tapped row in turn, eight floats at a time
+__attribute__((target("avx2,fma")))
+static void blend_rows_avx2(const weights *w, int o, float **rows, int width, float *out)
+{
+    const float *weight = &w->weights[(size_t) o * w->taps];
+    int n = width * CHANNELS;
+    memset(out, 0, n * sizeof(float));
+    for (int t = 0; t < w->taps; t++)
+    {
+        if (weight[t] == 0)
+        {
+            continue;
+        }
+        const float *row = rows[(w->first[o] + t) % w->taps];
+        __m256 wt = _mm256_set1_ps(weight[t]);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            _mm256_storeu_ps(&out[i], _mm256_fmadd_ps(wt, _mm256_loadu_ps(&row[i]), _mm256_loadu_ps(&out[i])));
+        }
+        for (; i < n; i++)
+        {
+            out[i] += weight[t] * row[i];
+        }
+    }
+}
+#endif
+
+// Returns true if the AVX2 passes can run here
+static bool have_avx2(void)
+{
+#ifdef SCALE_X86
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+// Resamples one row horizontally
+void scale_row(const weights *w, const float *in, float *out)
+{
+#ifdef SCALE_X86
+    if (have_avx2())
+    {
+        scale_row_avx2(w, in, out);
+        return;
+    }
+#endif
+    scale_row_scalar(w, in, out);
+}
+
+// Blends the rows feeding output row o vertically
+void blend_rows(const weights *w, int o, float **rows, int width, float *out)
+{
+#ifdef SCALE_X86
+    if (have_avx2())
+    {
+        blend_rows_avx2(w, o, rows, width, out);
+        return;
+    }
+#endif
+    blend_rows_scalar(w, o, rows, width, out);
+}
@@ -0,0 +1,56 @@
+// Separable resampling filters for resizing BMP rows
+
+#ifndef SCALE_H
+#define SCALE_H
+
+#include <stdbool.h>
+
+// Floats per pixel in working rows: blue, green, red and alpha (zero for 24-bit pixels)
+#define CHANNELS 4
+
+// Resampling filters
+typedef enum
+{
+    NEAREST,
+    BILINEAR,
+    BICUBIC,
+    LANCZOS
+}
+filter;
+
+// Precomputed taps for one axis: output index o blends taps input pixels from first[o],
+// weighted by weights[o * taps ...]. Taps past the edge of the input have zero weight
+typedef struct
+{
+    int in;
+    int out;
+    int taps;
+    int *first;
+    float *weights;
+}
+weights;
+
+// Parses a filter name (nearest, bilinear, bicubic or lanczos), returns false if unknown
+bool parse_filter(const char *name, filter *f);
+
+// Parses a scale factor, either one for both directions or widthxheight (e.g. 2.5 or 0.5x0.75),
+// returns false unless both are positive
+bool parse_factor(const char *s, double *fx, double *fy);
+
+// Returns size scaled by factor, never less than one pixel
+int scaled_size(int size, double factor);
+
+// Builds the weight table for scaling in pixels to out with filter f, returns false if out of memory
+bool make_weights(weights *w, int in, int out, filter f);
+
+// Frees a weight table
+void free_weights(weights *w);
+
+// Resamples one row horizontally. in holds w->in + w->taps pixels (the extra ones zeroed), out holds w->out
+void scale_row(const weights *w, const float *in, float *out);
+
+// Blends the rows feeding output row o vertically: rows[r % w->taps] holds horizontally scaled input row r,
+// width pixels wide
+void blend_rows(const weights *w, int o, float **rows, int width, float *out);
+
+#endif // SCALE_H
@@ -0,0 +1,326 @@
+// External merge sort: sorts bounded runs in memory, spills them to temporary
+// files and k-way merges them with a loser tree
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "extsort.h"
+
+// Sequential reader over one spilled run
+typedef struct
+{
+    FILE *file;
+    int *buf;
+    size_t cap;
+    size_t len;
+    size_t pos;
+    bool done;
+}
+run;
+
+// Tournament of k runs: tree[0] is the overall winner, tree[1..k-1] the losers
+typedef struct
+{
+    run *runs;
+    int *tree;
+    int k;
+}
+losertree;
+
+// Compares ints for qsort
+static int compare(const void *a, const void *b)
+{
+    int x = *(const int *) a;
+    int y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+// Refills a run's buffer from its file, marking it done at EOF
+static void refill(run *r)
+{
+    r->len = fread(r->buf, sizeof(int), r->cap, r->file);
+    r->pos = 0;
+    if (r->len == 0)
+    {
+        r->done = true;
+    }
+}
+
+// Returns true if run a's current value sorts before run b's (exhausted runs sort last)
+static bool less(losertree *lt, int a, int b)
+{
+    run *ra = &lt->runs[a];
+    run *rb = &lt->runs[b];
+    if (ra->done)
+    {
+        return false;
+    }
+    if (rb->done)
+    {
+        return true;
+    }
+    return ra->buf[ra->pos] < rb->buf[rb->pos];
+}
+
+// Plays the initial tournament below node, returning the subtree's winner
+static int build(losertree *lt, int node)
+{
+    if (node >= lt->k)
+    {
+        return node - lt->k;
+    }
+    int left = build(lt, 2 * node);
+    int right = build(lt, 2 * node + 1);
+    if (less(lt, left, right))
+    {
+        lt->tree[node] = right;
+        return left;
+    }
+    lt->tree[node] = left;
+    return right;
+}
+
+// Replays the path from run w's leaf to the root after w's value changed
+static void replay(losertree *lt, int w)
+{
+    for (int node = (w + lt->k) / 2; node > 0; node /= 2)
+    {
+        if (less(lt, lt->tree[node], w))
+        {
+            int tmp = lt->tree[node];
+            lt->tree[node] = w;
+            w = tmp;
+        }
+    }
+    lt->tree[0] = w;
+}
+
+// Merges k rewound run files into out, splitting memory between k input buffers
+// and one output buffer. Returns false on error
+static bool merge(FILE **files, int k, FILE *out, size_t budget)
+{
+    size_t cap = budget / sizeof(int) / (k + 1);
+    run *runs = calloc(k, sizeof(run));
+    int *tree = calloc(k, sizeof(int));
+    int *outbuf = malloc(cap * sizeof(int));
+    bool ok = runs != NULL && tree != NULL && outbuf != NULL;
+
+    for (int i = 0; ok && i < k; i++)
+    {
+        runs[i].file = files[i];
+        runs[i].cap = cap;
+        runs[i].buf = malloc(cap * sizeof(int));
+        if (runs[i].buf == NULL)
+        {
+            ok = false;
+            break;
+        }
+        rewind(files[i]);
+        refill(&runs[i]);
+    }
+
+    if (ok)
+    {
+        losertree lt = {.runs = runs, .tree = tree, .k = k};
+        tree[0] = (k == 1) ? 0 : build(&lt, 1);
+
+        size_t n = 0;
+        while (!runs[tree[0]].done)
+        {
+            // emit the winner and advance its run
+            run *r = &runs[tree[0]];
+            outbuf[n++] = r->buf[r->pos++];
+            if (r->pos == r->len)
+            {
+                refill(r);
+            }
+            replay(&lt, tree[0]);
+
+            // flush a full output buffer in one write
+            if (n == cap)
+            {
+                ok = fwrite(outbuf, sizeof(int), n, out) == n;
+                n = 0;
+                if (!ok)
+                {
+                    break;
+                }
+            }
+        }
+        if (ok && n > 0)
+        {
+            ok = fwrite(outbuf, sizeof(int), n, out) == n;
+        }
+    }
+
+    for (int i = 0; runs != NULL && i < k; i++)
+    {
+        free(runs[i].buf);
+    }
+    free(runs);
+    free(tree);
+    free(outbuf);
+    return ok;
+}
+
+// Sorts the values returned by next into a binary file at path within budget bytes
+long extsort(int (*next)(void), const char *path, size_t budget)
+{
+    if (budget < EXTSORT_MIN_BUDGET)
+    {
+        budget = EXTSORT_MIN_BUDGET;
+    }
+
+    // buffer for run formation
+    size_t cap = budget / sizeof(int);
+    int *values = malloc(cap * sizeof(int));
+    if (values == NULL)
+    {
+        return -1;
+    }
+
+    // spill sorted runs of at most cap values to temporary files
+    FILE **files = NULL;
+    int nfiles = 0;
+    long total = 0;
+    bool eof = false;
+    while (!eof)
+    {
+        size_t n = 0;
+        while (n < cap)
+        {
+            int straw = next();
+            if (straw == INT_MAX)
+            {
+                eof = true;
+                break;
+            }
+            values[n++] = straw;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        qsort(values, n, sizeof(int), compare);
+
+        FILE *tmp = tmpfile();
+        FILE **grown = realloc(files, (nfiles + 1) * sizeof(FILE *));
+        if (tmp == NULL || grown == NULL || fwrite(values, sizeof(int), n, tmp) != n)
+        {
+            if (tmp != NULL)
+            {
+                fclose(tmp);
+            }
+            total = -1;
+            if (grown != NULL)
+            {
+                files = grown;
+            }
+            break;
+        }
+        files = grown;
+        files[nfiles++] = tmp;
+        total += n;
+    }
+    free(values);
+
+    // merge in passes while there are more runs than buffers of at least the minimum budget
+    size_t buffers = budget / EXTSORT_MIN_BUDGET;
+    int fanin = (buffers > 4096) ? 4096 : (int) buffers - 1;
+    if (fanin < 2)
+    {
+        fanin = 2;
+    }
+    while (total >= 0 && nfiles > fanin)
+    {
+        int merged = 0;
+        for (int i = 0; i < nfiles; i += fanin)
+        {
+            int k = (nfiles - i < fanin) ? nfiles - i : fanin;
+            FILE *tmp = tmpfile();
+            if (tmp == NULL || !merge(&files[i], k, tmp, budget))
+            {
+                if (tmp != NULL)
+                {
+                    fclose(tmp);
+                }
+                total = -1;
+                break;
+            }
+            for (int j = i; j < i + k; j++)
+            {
+                fclose(files[j]);
+                files[j] = NULL;
+            }
+            files[merged++] = tmp;
+        }
+        if (total < 0)
+        {
+            break;
+        }
+        nfiles = merged;
+    }
+
+    // final merge straight into the output file
+    if (total >= 0)
+    {
+        FILE *out = fopen(path, "wb");
+        if (out == NULL)
+        {
+            total = -1;
+        }
+        else
+        {
+            if (nfiles > 0 && !merge(files, nfiles, out, budget))
+            {
+                total = -1;
+            }
+            if (fclose(out) != 0)
+            {
+                total = -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < nfiles; i++)
+    {
+        if (files[i] != NULL)
+        {
+            fclose(files[i]);
+        }
+    }
+    free(files);
+    return total;
+}
+
+// Parses a memory size with an optional K, M or G suffix
+size_t parse_budget(const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+    switch (*end)
+    {
+        case 'k':
+        case 'K':
+            n <<= 10;
+            end++;
+            break;
+        case 'm':
+        case 'M':
+            n <<= 20;
+            end++;
+            break;
+        case 'g':
+        case 'G':
+            n <<= 30;
+            end++;
+            break;
+    }
+    if (end == s || *end != '\0')
+    {
+        return 0;
+    }
+    return n;
+}
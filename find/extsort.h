@@ -0,0 +1,14 @@
+// External merge sort prototypes
+
+#include <stddef.h>
+
+// Smallest memory budget extsort will accept, in bytes
+#define EXTSORT_MIN_BUDGET (64 * 1024)
+
+// Sorts the values returned by next (until it returns INT_MAX) into a binary
+// file of native ints at path, using at most budget bytes of memory.
+// Returns the number of values written, or -1 on error
+long extsort(int (*next)(void), const char *path, size_t budget);
+
+// Parses a memory size such as 65536, 512K, 64M or 2G into bytes, or 0 if invalid
+size_t parse_budget(const char *s);
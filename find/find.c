@@ -1,25 +1,78 @@
 // Searches for a needle in a haystack
 
+#define _XOPEN_SOURCE 500
+
 #include <cs50.h>
+#include <ctype.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "extsort.h"
 #include "helpers.h"
 
 // Maximum amount of hay
 const int MAX = 65536;
 
+// Whether to search with a learned index instead of plain binary search
+bool learned = false;
+
+// Sorts hay from stdin out of core within budget bytes, then searches the sorted file
+int find_external(int needle, size_t budget, const char *path);
+
+// Searches sorted hay with the chosen strategy
+bool find_needle(int needle, int haystack[], int size);
+
 int main(int argc, string argv[])
 {
+    // Parse options: -m sorts out of core within a memory budget, -o names the sorted file,
+    // -l searches with a learned index. Parsing stops at a negative needle, as it does after --
+    size_t budget = 0;
+    string path = "haystack.bin";
+    int opt;
+    while (!(optind < argc && argv[optind][0] == '-' && isdigit((unsigned char) argv[optind][1]))
+           && (opt = getopt(argc, argv, "lm:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                learned = true;
+                break;
+            case 'm':
+                budget = parse_budget(optarg);
+                if (budget == 0)
+                {
+                    printf("Invalid memory budget %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'o':
+                path = optarg;
+                break;
+            default:
+                printf("Usage: ./find [-l] [-m memory] [-o sorted] [--] needle\n");
+                return -1;
+        }
+    }
+
     // Ensure proper usage
-    if (argc != 2)
+    if (argc - optind != 1)
     {
-        printf("Usage: ./find needle\n");
+        printf("Usage: ./find [-l] [-m memory] [-o sorted] [--] needle\n");
         return -1;
     }
 
     // Remember needle
-    int needle = atoi(argv[1]);
+    int needle = atoi(argv[optind]);
+
+    // Haystacks that may not fit in memory are sorted to disk
+    if (budget > 0)
+    {
+        return find_external(needle, budget, path);
+    }
 
     // Fill haystack
     int size;
@@ -43,7 +96,61 @@ int main(int argc, string argv[])
     sort(haystack, size);
 
     // Try to find needle in haystack
-    if (search(needle, haystack, size))
+    if (find_needle(needle, haystack, size))
+    {
+        printf("\nFound needle in haystack!\n\n");
+        return 0;
+    }
+    else
+    {
+        printf("\nDidn't find needle in haystack.\n\n");
+        return 1;
+    }
+}
+
+// Sorts hay from stdin out of core within budget bytes, then searches the sorted file
+int find_external(int needle, size_t budget, const char *path)
+{
+    // Sort the haystack into a binary file
+    long size = extsort(get_int, path, budget);
+    if (size < 0)
+    {
+        printf("Could not sort haystack into %s\n", path);
+        return -1;
+    }
+    if (size > INT_MAX)
+    {
+        printf("Haystack too large to search\n");
+        return -1;
+    }
+
+    // Map the sorted haystack rather than reading it back in
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Could not open %s\n", path);
+        return -1;
+    }
+    int *haystack = NULL;
+    if (size > 0)
+    {
+        haystack = mmap(NULL, size * sizeof(int), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (haystack == MAP_FAILED)
+        {
+            close(fd);
+            printf("Could not map %s\n", path);
+            return -1;
+        }
+    }
+    close(fd);
+
+    // Try to find needle in haystack
+    bool found = find_needle(needle, haystack, size);
+    if (haystack != NULL)
+    {
+        munmap(haystack, size * sizeof(int));
+    }
+    if (found)
     {
         printf("\nFound needle in haystack!\n\n");
         return 0;
@@ -54,3 +161,22 @@ int main(int argc, string argv[])
         return 1;
     }
 }
+
+// Searches sorted hay with the chosen strategy
+bool find_needle(int needle, int haystack[], int size)
+{
+    if (!learned)
+    {
+        return search(needle, haystack, size);
+    }
+
+    // Model the haystack, falling back to binary search if there's no memory for it
+    model m;
+    if (!train(&m, haystack, size))
+    {
+        return search(needle, haystack, size);
+    }
+    bool found = lookup(&m, needle, haystack, size);
+    untrain(&m);
+    return found;
+}
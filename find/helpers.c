@@ -1,6 +1,7 @@
 // Helper functions
 
 #include <cs50.h>
+#include <stdlib.h>
 
 #include "helpers.h"
 
@@ -59,3 +60,118 @@ void sort(int values[], int n)
         values[j] = element;
     }
 }
+
+// Returns the leaf the root model routes value to
+static int route(model *m, int value)
+{
+    double position = ((double) value - m->min) * m->nleaves / ((double) m->max - m->min + 1);
+    if (position < 0)
+    {
+        return 0;
+    }
+    if (position >= m->nleaves)
+    {
+        return m->nleaves - 1;
+    }
+    return (int) position;
+}
+
+// Returns the position in leaf f's slice of values that its line predicts for value, clamped to the slice,
+// which mustn't be empty
+static int predict(leaf *f, int value, int values[])
+{
+    double predicted = f->lo + f->slope * ((double) value - values[f->lo]);
+    if (predicted < f->lo)
+    {
+        return f->lo;
+    }
+    if (predicted > f->hi - 1)
+    {
+        return f->hi - 1;
+    }
+    return (int) predicted;
+}
+
+// Builds a learned index over n sorted values
+bool train(model *m, int values[], int n)
+{
+    m->nleaves = n / LEAF_SIZE + 1;
+    m->leaves = calloc(m->nleaves, sizeof(leaf));
+    if (m->leaves == NULL)
+    {
+        return false;
+    }
+    m->min = (n > 0) ? values[0] : 0;
+    m->max = (n > 0) ? values[n - 1] : 0;
+
+    //the root is monotonic, so each leaf owns a contiguous slice of values
+    int i = 0;
+    for (int l = 0; l < m->nleaves; l++)
+    {
+        leaf *f = &m->leaves[l];
+        f->lo = i;
+        while (i < n && route(m, values[i]) == l)
+        {
+            i++;
+        }
+        f->hi = i;
+
+        //fit a line through the slice's endpoints
+        if (f->hi - f->lo > 1 && values[f->hi - 1] != values[f->lo])
+        {
+            f->slope = (double) (f->hi - 1 - f->lo) / ((double) values[f->hi - 1] - values[f->lo]);
+        }
+
+        //remember the worst prediction so lookups know how far to look
+        for (int j = f->lo; j < f->hi; j++)
+        {
+            int error = abs(predict(f, values[j], values) - j);
+            if (error > f->error)
+            {
+                f->error = error;
+            }
+        }
+    }
+    return true;
+}
+
+// Returns true if value is in the n sorted values indexed by m, else false
+bool lookup(model *m, int value, int values[], int n)
+{
+    if (n == 0 || value < m->min || value > m->max)
+    {
+        return false;
+    }
+    leaf *f = &m->leaves[route(m, value)];
+    int lo = f->lo;
+    int hi = f->hi;
+
+    //routing is monotonic, so a value outside its leaf's slice isn't anywhere
+    if (lo == hi || value < values[lo] || value > values[hi - 1])
+    {
+        return false;
+    }
+
+    //search a small window around the prediction unless the data was too skewed to model
+    if (f->error <= MAX_ERROR)
+    {
+        int predicted = predict(f, value, values);
+        if (predicted - f->error > lo)
+        {
+            lo = predicted - f->error;
+        }
+        if (predicted + f->error + 1 < hi)
+        {
+            hi = predicted + f->error + 1;
+        }
+    }
+    return search(value, &values[lo], hi - lo);
+}
+
+// Frees a learned index
+void untrain(model *m)
+{
+    free(m->leaves);
+    m->leaves = NULL;
+    m->nleaves = 0;
+}
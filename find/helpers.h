@@ -8,3 +8,38 @@ bool search(int value, int values[], int n);
 
 // Sorts array of n values
 void sort(int values[], int n);
+
+// Average number of values per leaf of a learned index
+#define LEAF_SIZE 256
+
+// Largest prediction error a leaf may have before it falls back to binary search
+#define MAX_ERROR 32
+
+// Linear model of the positions of the values routed to one leaf
+typedef struct
+{
+    int lo;
+    int hi;
+    double slope;
+    int error;
+}
+leaf;
+
+// Two-level piecewise-linear index over a sorted array
+typedef struct
+{
+    int min;
+    int max;
+    int nleaves;
+    leaf *leaves;
+}
+model;
+
+// Builds a learned index over n sorted values, returns false if out of memory
+bool train(model *m, int values[], int n);
+
+// Returns true if value is in the n sorted values indexed by m, else false
+bool lookup(model *m, int value, int values[], int n);
+
+// Frees a learned index
+void untrain(model *m);
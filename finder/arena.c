@@ -0,0 +1,48 @@
+// Blocks that many small allocations are carved from and freed with all at once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Returns a copy of the first length bytes of s that lasts until the arena is freed
+char *arena_copy(arena *a, const char *s, size_t length)
+{
+    //a string too long for the current block starts a new one, at least big enough to hold it
+    block *b = a->head;
+    if (b == NULL || b->size - b->used < length + 1)
+    {
+        size_t size = a->next ? a->next : ARENA_FIRST;
+        a->next = (size < ARENA_LAST) ? size * 2 : ARENA_LAST;
+        if (size < length + 1)
+        {
+            size = length + 1;
+        }
+        b = malloc(sizeof(block) + size);
+        if (b == NULL)
+        {
+            return NULL;
+        }
+        b->next = a->head;
+        b->size = size;
+        b->used = 0;
+        a->head = b;
+    }
+    char *copy = b->data + b->used;
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+    b->used += length + 1;
+    return copy;
+}
+
+// Frees every block of an arena
+void arena_free(arena *a)
+{
+    while (a->head != NULL)
+    {
+        block *b = a->head;
+        a->head = b->next;
+        free(b);
+    }
+    a->next = 0;
+}
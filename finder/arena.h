@@ -0,0 +1,37 @@
+// Blocks that many small allocations are carved from and freed with all at once
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Smallest and largest blocks an arena allocates, doubling from one to the other as it fills
+#define ARENA_FIRST 1024
+#define ARENA_LAST (64 << 10)
+
+// One block of an arena, chained to the one filled before it
+typedef struct block
+{
+    struct block *next;
+    size_t size;
+    size_t used;
+    char data[];
+}
+block;
+
+// An arena, which starts out empty
+typedef struct
+{
+    block *head;
+    size_t next;
+}
+arena;
+
+// Returns a copy of the first length bytes of s, terminated, that lasts until the arena is freed,
+// or NULL if memory runs out
+char *arena_copy(arena *a, const char *s, size_t length);
+
+// Frees every block of an arena, leaving it empty for reuse
+void arena_free(arena *a);
+
+#endif // ARENA_H
@@ -1,221 +1,381 @@
 // Recursively searches for a query in a directory.
 
-#define _BSD_SOURCE
 #define _GNU_SOURCE
 
-#include <cs50.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
-
-#define MAXLENGTH 50
+#include <unistd.h>
+
+#include "index.h"
+#include "search.h"
+#include "sink.h"
+#include "walk.h"
+
+// How to run finder
+const char *USAGE = "Usage: ./finder [options] <string> [directory/]\n"
+                    "       ./finder [options] (-e pattern | -f patterns.txt)... [directory/]\n"
+                    "       ./finder [options] -x index (<string> | (-e pattern | -f patterns.txt)...)\n"
+                    "       ./finder [-j threads] -i index [directory/]\n"
+                    "       ./finder [-j threads] -u index\n"
+                    "Options: [-j threads] [-o found.txt | -] [-F text | json] [-s]\n";
+
+// Patterns from -e and -f, in the order they were given
+typedef struct
+{
+    char **list;
+    int count;
+    int capacity;
+}
+pattern_list;
 
-// Struct to hold the file name and type
+// What the searching threads share
 typedef struct
 {
-    string name;
-    string type;
+    patterns p;
+    bool json;
+    sink out;
 }
-path;
+search;
 
-// Struct to hold the directory info
+// One file's matching lines, gathered in memory from the first on so they reach the output together
 typedef struct
 {
-    string name;
-    int npaths;
-    path *paths;
+    search *s;
+    const folder *dir;
+    const char *name;
+    FILE *lines;
+    char *text;
+    size_t size;
 }
-directory;
+hits;
+
+// Indexes the tree under root into index_file, or if root is NULL updates the index already there
+int build(char *index_file, const char *root, int threads);
+
+// Appends a copy of pattern to a list, doubling its capacity as needed
+bool add_pattern(pattern_list *l, const char *pattern);
 
-// String to hold the word to seek
-string key;
+// Appends each non-empty line of the file at path to a list
+bool read_patterns(pattern_list *l, const char *path);
 
-// The function to search for files in a directory and populate the struct
-directory populate(directory dir);
+// Frees a list of patterns
+void free_list(pattern_list *l);
 
-// The function to recursively iterate through directories and handle files
-int seek(directory dir);
+// Searches one file for every pattern, queueing each line they're on for the output,
+// as pattern,path:number:line or one JSON object per line
+void search_entry(const folder *dir, const char *name, void *arg);
 
+// Adds a matching line to its file's hits
+void add_line(const line *l, void *arg);
+
+// Writes length bytes of s as the inside of a JSON string, escaping quotes, backslashes and control characters
+void put_json(const char *s, size_t length, FILE *f);
 
 int main(int argc, char *argv[])
 {
+    //-j lists directories and searches files with that many threads, by default one per processor.
+    //-e adds a pattern and -f adds each line of a file as one, all matched in one pass over each file;
+    //without either, the first argument is the one pattern.
+    //-i indexes the tree's trigrams and -u updates an index, reading only files changed since it was built;
+    //-x searches just the files that index says could match, which are still read to find the lines.
+    //-o appends matches to another file than found.txt, or - for standard output, -F json writes them
+    //as JSON lines instead of text, and -s sorts them by path once the search is done
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    pattern_list l = {0};
+    int mode = 0;
+    char *index_file = NULL;
+    char *output = "found.txt";
+    bool json = false;
+    bool sorted = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:f:F:i:j:o:su:x:")) != -1)
+    {
+        bool ok;
+        switch (opt)
+        {
+            case 'i':
+            case 'u':
+            case 'x':
+                ok = mode == 0;
+                mode = opt;
+                index_file = optarg;
+                break;
+            case 'e':
+                ok = add_pattern(&l, optarg);
+                break;
+            case 'f':
+                ok = read_patterns(&l, optarg);
+                if (!ok)
+                {
+                    fprintf(stderr, "Could not read patterns from %s.\n", optarg);
+                    free_list(&l);
+                    return 1;
+                }
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                ok = threads > 0;
+                break;
+            case 'F':
+                json = strcmp(optarg, "json") == 0;
+                ok = json || strcmp(optarg, "text") == 0;
+                break;
+            case 'o':
+                output = optarg;
+                ok = true;
+                break;
+            case 's':
+                sorted = true;
+                ok = true;
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "%s", USAGE);
+            free_list(&l);
+            return 1;
+        }
+    }
 
     //Ensure proper number of command line arguments
-    if (argc != 2 || argc != 3)
+    if (mode == 'i' || mode == 'u')
+    {
+        bool ok = l.count == 0 && argc - optind <= (mode == 'i' ? 1 : 0);
+        free_list(&l);
+        if (!ok)
+        {
+            fprintf(stderr, "%s", USAGE);
+            return 1;
+        }
+        char *root = (mode == 'u') ? NULL : (argc - optind == 1) ? argv[optind] : "./";
+        return build(index_file, root, threads);
+    }
+    int given = (l.count == 0) ? 1 : 0;
+    int roots = (mode == 'x') ? 0 : 1;
+    if (argc - optind < given || argc - optind > given + roots || (given && !add_pattern(&l, argv[optind])))
     {
-        printf("Usage: ./finder <string> [directory/]\n");
+        fprintf(stderr, "%s", USAGE);
+        free_list(&l);
         return 1;
     }
 
-    //set key variable
-    key = argv[1];
+    //set the directory to search based on command line arguments entered
+    search s;
+    char *root = (argc - optind > given) ? argv[optind + given] : "./";
+    if (!compile_patterns(&s.p, l.list, l.count))
+    {
+        fprintf(stderr, "Patterns can't be empty or span lines.\n");
+        free_list(&l);
+        return 1;
+    }
 
-    // Create initial directory and set name string
-    directory dir;
+    //matching lines are appended to the output by one thread while the others search
+    bool to_stdout = strcmp(output, "-") == 0;
+    FILE *found = to_stdout ? stdout : fopen(output, "a");
+    if (found == NULL || !sink_open(&s.out, found, sorted))
+    {
+        fprintf(stderr, "File could not be opened.\n");
+        if (found != NULL && !to_stdout)
+        {
+            fclose(found);
+        }
+        free_patterns(&s.p);
+        free_list(&l);
+        return 2;
+    }
+    s.json = json;
 
-    //Set "dir"s name based on command line arguments entered
-    if (argc == 3)
+    //an index narrows the search to the files with the patterns' trigrams
+    bool ok;
+    if (mode == 'x')
     {
-        dir.name = argv[2];
+        trigram_index x;
+        ok = open_index(&x, index_file);
+        if (ok)
+        {
+            ok = search_index(&x, &s.p, threads, search_entry, &s);
+            close_index(&x);
+        }
     }
     else
     {
-        dir.name = "./";
+        ok = walk(root, threads, search_entry, &s);
     }
-
-
-
-    return seek(dir);
+    bool written = sink_close(&s.out);
+    free_patterns(&s.p);
+    free_list(&l);
+    if ((!written || (!to_stdout && fclose(found) != 0)) && ok)
+    {
+        fprintf(stderr, "Could not write %s.\n", output);
+        return 2;
+    }
+    if (!ok && mode == 'x')
+    {
+        fprintf(stderr, "Could not search with index %s.\n", index_file);
+        return 2;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Opening directory failed. Check your input filepath!\n");
+        return 1;
+    }
+    return 0;
 }
 
-directory populate(directory dir)
+// Indexes the tree under root into index_file, or if root is NULL updates the index already there
+int build(char *index_file, const char *root, int threads)
 {
-    // Initialize all pointers and values in the given struct
-    dir.npaths = 0;
-    dir.paths = NULL;
-    DIR *dirp;
-    struct dirent* entry;
-
-    dirp = opendir(dir.name);
-    if (dirp == NULL)
+    //an update reads back the files it can reuse from the old index, which covers the same root
+    trigram_index old;
+    bool update = root == NULL;
+    if (update)
+    {
+        if (!open_index(&old, index_file))
+        {
+            fprintf(stderr, "Could not open index %s.\n", index_file);
+            return 2;
+        }
+        root = index_root(&old);
+    }
+    bool ok = build_index(index_file, root, update ? &old : NULL, threads);
+    if (update)
+    {
+        close_index(&old);
+    }
+    if (!ok)
     {
-        printf("Opening directory failed. Check your input filepath!\n");
-        return dir;
+        fprintf(stderr, "Could not build index %s.\n", index_file);
+        return 2;
     }
+    return 0;
+}
 
-    while ((entry = readdir(dirp)) != NULL)
+// Appends a copy of pattern to a list, doubling its capacity as needed
+bool add_pattern(pattern_list *l, const char *pattern)
+{
+    if (l->count == l->capacity)
     {
-        if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        int capacity = l->capacity ? l->capacity * 2 : 16;
+        char **list = realloc(l->list, capacity * sizeof(char *));
+        if (list == NULL)
         {
-            // Allocate zeroed-out memory for the construction of the file name
-            string name = calloc(1, strlen(dir.name) + strlen(entry->d_name) + 2);
-            strcat(name, dir.name);
-            strcat(name, entry->d_name);
-            strcat(name, "/");
-
-            // Reallocate memory to expand the array
-            dir.paths = realloc(dir.paths, (dir.npaths + 1) * sizeof(path));
-
-            // Add a new element to the array containing names and types
-            path newPath = {.name = name, .type = "directory"};
-            dir.paths[dir.npaths] = newPath;
-
-            // Increase file count for the directory
-            dir.npaths++;
+            return false;
         }
+        l->list = list;
+        l->capacity = capacity;
+    }
+    l->list[l->count] = strdup(pattern);
+    return l->list[l->count++] != NULL;
+}
 
-        // Else if entry is a file, increase file count and populate the struct
-        else if (entry->d_type == DT_REG)
+// Appends each non-empty line of the file at path to a list
+bool read_patterns(pattern_list *l, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+    char *buffer = NULL;
+    size_t size = 0;
+    ssize_t n;
+    bool ok = true;
+    while (ok && (n = getline(&buffer, &size, file)) > 0)
+    {
+        if (buffer[n - 1] == '\n')
         {
-            // Allocate zeroed-out memory for the construction of the file name
-            string name = calloc(1, strlen(dir.name) + strlen(entry->d_name) + 1);
-            strcat(name, dir.name);
-            strcat(name, entry->d_name);
-
-            // Reallocate memory to expand the array
-            dir.paths = realloc(dir.paths, (dir.npaths + 1) * sizeof(path));
+            buffer[--n] = '\0';
+        }
+        ok = n == 0 || add_pattern(l, buffer);
+    }
+    free(buffer);
+    fclose(file);
+    return ok;
+}
 
-            // Add a new element to the array containing names and types
-            path newPath = {.name = name, .type = "file"};
-            dir.paths[dir.npaths] = newPath;
+// Frees a list of patterns
+void free_list(pattern_list *l)
+{
+    for (int k = 0; k < l->count; k++)
+    {
+        free(l->list[k]);
+    }
+    free(l->list);
+}
 
-            // Increase file count for the directory
-            dir.npaths++;
-        }
+// Searches one file for every pattern, queueing each line they're on for the output,
+// as pattern,path:number:line or one JSON object per line
+void search_entry(const folder *dir, const char *name, void *arg)
+{
+    search *s = arg;
+    hits h = {.s = s, .dir = dir, .name = name};
+    if (!search_file(dir->fd, name, &s->p, add_line, &h))
+    {
+        fprintf(stderr, "Could not read %s%s.\n", dir->path, name);
+    }
+    if (h.lines == NULL)
+    {
+        return;
+    }
+    fclose(h.lines);
+    if (!sink_push(&s->out, dir->path, name, h.text, h.size))
+    {
+        fprintf(stderr, "Could not record matches in %s%s.\n", dir->path, name);
     }
+}
 
-    // Close directory stream using system call closedir and return struct
-    closedir(dirp);
-    return dir;
+// Adds a matching line to its file's hits
+void add_line(const line *l, void *arg)
+{
+    hits *h = arg;
+    if (h->lines == NULL && (h->lines = open_memstream(&h->text, &h->size)) == NULL)
+    {
+        return;
+    }
+    const char *pattern = h->s->p.list[l->pattern];
+    if (!h->s->json)
+    {
+        fprintf(h->lines, "%s,%s%s:%zu:", pattern, h->dir->path, h->name, l->number);
+        fwrite(l->text, 1, l->length, h->lines);
+        fputc('\n', h->lines);
+        return;
+    }
+    fputs("{\"pattern\":\"", h->lines);
+    put_json(pattern, strlen(pattern), h->lines);
+    fputs("\",\"path\":\"", h->lines);
+    put_json(h->dir->path, strlen(h->dir->path), h->lines);
+    put_json(h->name, strlen(h->name), h->lines);
+    fprintf(h->lines, "\",\"line\":%zu,\"column\":%zu,\"text\":\"", l->number, l->column);
+    put_json(l->text, l->length, h->lines);
+    fputs("\"}\n", h->lines);
 }
 
-// Recursive function to iterate through directories and search files
-int seek(directory dir)
+// Writes length bytes of s as the inside of a JSON string, escaping quotes, backslashes and control characters
+void put_json(const char *s, size_t length, FILE *f)
 {
-    //poulate directory
-    populate(dir);
-    /*  typedef struct
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
         {
-        string name;
-        string type;
+            fputc('\\', f);
+            fputc(c, f);
         }
-        path;
-
-        typedef struct
+        else if (c == '\t')
         {
-        string name;
-        int npaths;
-        path *paths;
+            fputs("\\t", f);
         }
-        directory;
-        */
-    for (int i = 0; i < dir.npaths; i++)
-    {
-        string file = "file";
-        if (strcmp(dir.paths -> type, file) == 0)
+        else if (c < 0x20 || c == 0x7f)
         {
-            //open the file
-            FILE* fp = fopen(dir.paths -> name, "r");
-
-            //error check on file open
-            if (fp == NULL)
-            {
-                printf("File does not exist.\n");
-                return -2;
-            }
-
-            //scan the file for key
-            char keyfound [strlen(key)];
-
-            //iterate through strings found in fp until key is found or returns null
-            while (fgets(keyfound, 50, fp) != NULL && fgets(keyfound, 50, fp) != key)
-            {
-                fgets(keyfound, 50, fp);
-            }
-
-            if (strcmp(keyfound, key) == 0)
-            {
-                //open output file and error check
-                FILE* fpf = fopen("found.txt", "a");
-                if (fpf == NULL)
-                {
-                    printf("File could not be opened.\n");
-                    return -2;
-                }
-
-                //Put name and file of found keyword
-                for (int k = 0; k < strlen(key); k++)
-                {
-                    fputc(key[k], fpf);
-                }
-                //separating with ","
-                fputc(',', fpf);
-
-                for (int j = 0; j < strlen(key); j++)
-                {
-                    fputc(dir.paths -> name[j], fpf);
-                }
-                //seprating with newline
-                fputs("\n", fpf);
-
-                //close file
-                fclose(fpf);
-
-            }
-            fclose(fp);
+            fprintf(f, "\\u%04x", c);
         }
-
-        string dire = "directory";
-        if (strcmp(dir.paths -> type, dire) == 0)
+        else
         {
-            directory subdir;
-            subdir.name = "subdir";
-            populate(subdir);
-            seek(subdir);
+            fputc(c, f);
         }
-
     }
-
-    return 0;
 }
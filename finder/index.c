@@ -0,0 +1,803 @@
+// A persistent trigram index of a directory tree
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "search.h"
+
+// How many trigrams there can be, one for every 3 bytes
+#define TRIGRAMS (1 << 24)
+
+// A file found while building, with its trigrams once they're known
+typedef struct
+{
+    char *path;
+    int64_t mtime;
+    int64_t size;
+    long old;
+    uint32_t *trigrams;
+    uint32_t count;
+}
+record;
+
+// Room for finding one file's distinct trigrams, kept for the next file once it's done
+typedef struct scratch
+{
+    uint64_t *seen;
+    uint32_t *list;
+    size_t count;
+    size_t capacity;
+    struct scratch *next;
+}
+scratch;
+
+// Shared state of the indexing threads
+typedef struct
+{
+    const trigram_index *old;
+    size_t root_length;
+    pthread_mutex_t lock;
+    record *records;
+    size_t count;
+    size_t capacity;
+    arena paths;
+    scratch *spare;
+    atomic_bool ok;
+}
+builder;
+
+// Shared state of the threads searching an index's candidates
+typedef struct
+{
+    const trigram_index *x;
+    folder *top;
+    uint32_t *files;
+    size_t count;
+    atomic_size_t next;
+    visit found;
+    void *arg;
+}
+query_job;
+
+// Checks that what an index's sections point at lies within them: the root and every name end
+// before the section after them, and each posting list, at a byte or more per file, starts in the postings
+static bool check_sections(const trigram_index *x)
+{
+    const index_header *h = x->header;
+    if (memchr(x->data + h->root, '\0', h->entries - h->root) == NULL)
+    {
+        return false;
+    }
+    uint64_t names = h->postings - h->names;
+    if (names > 0 && x->names[names - 1] != '\0')
+    {
+        return false;
+    }
+    for (uint32_t f = 0; f < h->files; f++)
+    {
+        if (x->entries[f].name >= names)
+        {
+            return false;
+        }
+    }
+    uint64_t postings = h->table - h->postings;
+    for (uint32_t t = 0; t < h->trigrams; t++)
+    {
+        if (x->table[t].offset > postings || x->table[t].count > postings - x->table[t].offset)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Maps the index at path into memory
+bool open_index(trigram_index *x, const char *path)
+{
+    memset(x, 0, sizeof(trigram_index));
+    x->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (x->fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(x->fd, &st) != 0 || st.st_size < (off_t) sizeof(index_header))
+    {
+        close(x->fd);
+        return false;
+    }
+    x->size = st.st_size;
+    x->data = mmap(NULL, x->size, PROT_READ, MAP_PRIVATE, x->fd, 0);
+    if (x->data == MAP_FAILED)
+    {
+        close(x->fd);
+        return false;
+    }
+
+    //every section has to lie within the file, in order, with the tables aligned as they're written
+    const index_header *h = x->header = (const index_header *) x->data;
+    if (h->magic != INDEX_MAGIC || h->version != INDEX_VERSION || h->size != x->size
+        || h->root >= h->entries || h->entries + (uint64_t) h->files * sizeof(file_entry) > h->names
+        || h->names > h->postings || h->postings > h->table
+        || h->table + (uint64_t) h->trigrams * sizeof(trigram_entry) > h->size
+        || h->entries % 8 != 0 || h->table % 8 != 0)
+    {
+        close_index(x);
+        return false;
+    }
+    x->entries = (const file_entry *) (x->data + h->entries);
+    x->names = (const char *) x->data + h->names;
+    x->table = (const trigram_entry *) (x->data + h->table);
+    x->postings = x->data + h->postings;
+
+    //posting lists are only read as far as a search needs, so next_file keeps them within the postings
+    if (!check_sections(x))
+    {
+        close_index(x);
+        return false;
+    }
+    return true;
+}
+
+// Unmaps an index and closes its file
+void close_index(trigram_index *x)
+{
+    munmap((void *) x->data, x->size);
+    close(x->fd);
+    memset(x, 0, sizeof(trigram_index));
+}
+
+// Returns the absolute path of the directory an index covers
+const char *index_root(const trigram_index *x)
+{
+    return (const char *) x->data + x->header->root;
+}
+
+// Returns the number of the indexed file at path, or -1 if it isn't indexed
+static long find_file(const trigram_index *x, const char *path)
+{
+    long lo = 0;
+    long hi = x->header->files;
+    while (lo < hi)
+    {
+        long mid = lo + (hi - lo) / 2;
+        int c = strcmp(x->names + x->entries[mid].name, path);
+        if (c == 0)
+        {
+            return mid;
+        }
+        if (c < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+// Returns the entry for trigram t, or NULL if no file has it
+static const trigram_entry *find_trigram(const trigram_index *x, uint32_t t)
+{
+    long lo = 0;
+    long hi = x->header->trigrams;
+    while (lo < hi)
+    {
+        long mid = lo + (hi - lo) / 2;
+        if (x->table[mid].trigram == t)
+        {
+            return &x->table[mid];
+        }
+        if (x->table[mid].trigram < t)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Reads the next file number of one of x's posting lists from *p into *f, which holds the one before it.
+// Returns false if the list runs out of the postings or names a file x doesn't have
+static inline bool next_file(const trigram_index *x, const unsigned char **p, uint32_t *f)
+{
+    const unsigned char *end = (const unsigned char *) x->table;
+    uint64_t gap = 0;
+    int shift = 0;
+    unsigned char byte;
+    do
+    {
+        if (*p == end || shift > 28)
+        {
+            return false;
+        }
+        byte = *(*p)++;
+        gap |= (uint64_t) (byte & 0x7f) << shift;
+        shift += 7;
+    }
+    while (byte & 0x80);
+    if (*f + gap >= x->header->files)
+    {
+        return false;
+    }
+    *f += gap;
+    return true;
+}
+
+// Writes size bytes to an index being built, counting them
+static bool put(FILE *out, const void *data, size_t size, uint64_t *written)
+{
+    *written += size;
+    return fwrite(data, 1, size, out) == size;
+}
+
+// Pads an index being built with zeroes to a multiple of 8 bytes
+static bool align(FILE *out, uint64_t *written)
+{
+    static const char zeroes[8];
+    return put(out, zeroes, -*written & 7, written);
+}
+
+// Takes a scratch from the spares, or makes one
+static scratch *take_scratch(builder *b)
+{
+    pthread_mutex_lock(&b->lock);
+    scratch *s = b->spare;
+    if (s != NULL)
+    {
+        b->spare = s->next;
+    }
+    pthread_mutex_unlock(&b->lock);
+    if (s == NULL && (s = calloc(1, sizeof(scratch))) != NULL && (s->seen = calloc(TRIGRAMS / 64, sizeof(uint64_t))) == NULL)
+    {
+        free(s);
+        s = NULL;
+    }
+    return s;
+}
+
+// Clears a scratch and returns it to the spares
+static void give_scratch(builder *b, scratch *s)
+{
+    for (size_t i = 0; i < s->count; i++)
+    {
+        s->seen[s->list[i] / 64] = 0;
+    }
+    s->count = 0;
+    pthread_mutex_lock(&b->lock);
+    s->next = b->spare;
+    b->spare = s;
+    pthread_mutex_unlock(&b->lock);
+}
+
+// Lists the distinct trigrams of a file's contents in a scratch, skipping those spanning lines
+static bool collect(const char *data, size_t size, void *arg)
+{
+    scratch *s = arg;
+    uint32_t t = 0;
+    int run = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned char c = data[i];
+        if (c == '\n')
+        {
+            run = 0;
+            continue;
+        }
+        t = ((t << 8) | c) & (TRIGRAMS - 1);
+        if (run < 3)
+        {
+            run++;
+        }
+        if (run < 3 || (s->seen[t / 64] >> (t % 64) & 1))
+        {
+            continue;
+        }
+        if (s->count == s->capacity)
+        {
+            size_t capacity = s->capacity ? s->capacity * 2 : 4096;
+            uint32_t *list = realloc(s->list, capacity * sizeof(uint32_t));
+            if (list == NULL)
+            {
+                return false;
+            }
+            s->list = list;
+            s->capacity = capacity;
+        }
+        s->seen[t / 64] |= (uint64_t) 1 << (t % 64);
+        s->list[s->count++] = t;
+    }
+    return true;
+}
+
+// Adds a file at path to the records, doubling their capacity as needed
+static bool add_record(builder *b, record r, const char *path)
+{
+    pthread_mutex_lock(&b->lock);
+    r.path = arena_copy(&b->paths, path, strlen(path));
+    bool ok = r.path != NULL;
+    if (ok && b->count == b->capacity)
+    {
+        size_t capacity = b->capacity ? b->capacity * 2 : 1024;
+        record *records = realloc(b->records, capacity * sizeof(record));
+        ok = records != NULL;
+        if (ok)
+        {
+            b->records = records;
+            b->capacity = capacity;
+        }
+    }
+    if (ok)
+    {
+        b->records[b->count++] = r;
+    }
+    pthread_mutex_unlock(&b->lock);
+    return ok;
+}
+
+// Indexes one file found by the walk, or notes it's unchanged since the old index
+static void index_entry(const folder *dir, const char *name, void *arg)
+{
+    builder *b = arg;
+    record r = {.old = -1};
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s%s", dir->path + b->root_length, name) >= (int) sizeof(path))
+    {
+        fprintf(stderr, "Could not index %s%s, its path is too long.\n", dir->path, name);
+        return;
+    }
+
+    //an unchanged file's trigrams are already in the old index
+    struct stat st;
+    long k = b->old ? find_file(b->old, path) : -1;
+    if (k >= 0 && fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0
+        && b->old->entries[k].mtime == st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec
+        && b->old->entries[k].size == st.st_size)
+    {
+        r.old = k;
+    }
+    else
+    {
+        scratch *s = take_scratch(b);
+        if (s == NULL)
+        {
+            atomic_store(&b->ok, false);
+            return;
+        }
+        if (!with_file(dir->fd, name, &st, collect, s))
+        {
+            fprintf(stderr, "Could not read %s%s.\n", dir->path, name);
+            give_scratch(b, s);
+            return;
+        }
+        r.count = s->count;
+        r.trigrams = malloc(s->count * sizeof(uint32_t));
+        if (r.trigrams != NULL)
+        {
+            memcpy(r.trigrams, s->list, s->count * sizeof(uint32_t));
+        }
+        give_scratch(b, s);
+        if (r.trigrams == NULL && r.count > 0)
+        {
+            atomic_store(&b->ok, false);
+            return;
+        }
+    }
+    r.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    r.size = st.st_size;
+    if (!add_record(b, r, path))
+    {
+        free(r.trigrams);
+        atomic_store(&b->ok, false);
+    }
+}
+
+// Orders records by path
+static int by_path(const void *a, const void *b)
+{
+    return strcmp(((const record *) a)->path, ((const record *) b)->path);
+}
+
+// Gives each unchanged record its trigrams from the old index, decoding the postings once
+static bool reuse_trigrams(const trigram_index *old, record *records, size_t count)
+{
+    long *renumber = malloc(old->header->files * sizeof(long));
+    if (renumber == NULL)
+    {
+        return false;
+    }
+    for (uint32_t f = 0; f < old->header->files; f++)
+    {
+        renumber[f] = -1;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (records[i].old >= 0)
+        {
+            renumber[records[i].old] = i;
+        }
+    }
+
+    //the first pass counts each record's trigrams, the second fills them in
+    bool ok = true;
+    for (int pass = 0; ok && pass < 2; pass++)
+    {
+        for (uint32_t t = 0; ok && t < old->header->trigrams; t++)
+        {
+            const unsigned char *p = old->postings + old->table[t].offset;
+            uint32_t f = 0;
+            for (uint32_t n = 0; ok && n < old->table[t].count; n++)
+            {
+                ok = next_file(old, &p, &f);
+                long i = ok ? renumber[f] : -1;
+                if (i < 0)
+                {
+                    continue;
+                }
+                if (pass == 0)
+                {
+                    records[i].count++;
+                }
+                else
+                {
+                    records[i].trigrams[records[i].count++] = old->table[t].trigram;
+                }
+            }
+        }
+        for (size_t i = 0; pass == 0 && i < count; i++)
+        {
+            if (records[i].old >= 0 && records[i].count > 0)
+            {
+                records[i].trigrams = malloc(records[i].count * sizeof(uint32_t));
+                ok = ok && records[i].trigrams != NULL;
+                records[i].count = 0;
+            }
+        }
+    }
+    free(renumber);
+    return ok;
+}
+
+// Inverts the records' trigram lists into posting lists and writes the whole index to out
+static bool write_index(FILE *out, const char *root, record *records, size_t count)
+{
+    //count the files with each trigram, then give those that have any a place in the table
+    uint32_t *slots = calloc(TRIGRAMS, sizeof(uint32_t));
+    if (slots == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        for (uint32_t n = 0; n < records[i].count; n++)
+        {
+            slots[records[i].trigrams[n]]++;
+        }
+    }
+    uint32_t trigrams = 0;
+    size_t total = 0;
+    for (uint32_t t = 0; t < TRIGRAMS; t++)
+    {
+        trigrams += slots[t] > 0;
+        total += slots[t];
+    }
+    trigram_entry *table = malloc((trigrams ? trigrams : 1) * sizeof(trigram_entry));
+    uint32_t *files = malloc((total ? total : 1) * sizeof(uint32_t));
+    if (table == NULL || files == NULL)
+    {
+        free(slots);
+        free(table);
+        free(files);
+        return false;
+    }
+
+    //files are added in order, so every list comes out ascending; each entry's count is refilled as it goes
+    size_t first = 0;
+    for (uint32_t t = 0, n = 0; t < TRIGRAMS; t++)
+    {
+        if (slots[t] > 0)
+        {
+            table[n] = (trigram_entry) {.trigram = t, .offset = first};
+            first += slots[t];
+            slots[t] = n++;
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        for (uint32_t n = 0; n < records[i].count; n++)
+        {
+            trigram_entry *e = &table[slots[records[i].trigrams[n]]];
+            files[e->offset + e->count++] = i;
+        }
+        free(records[i].trigrams);
+        records[i].trigrams = NULL;
+    }
+    free(slots);
+
+    //the header is written again at the end once every section's offset is known
+    index_header h = {.magic = INDEX_MAGIC, .version = INDEX_VERSION, .files = count, .trigrams = trigrams};
+    uint64_t written = 0;
+    bool ok = put(out, &h, sizeof(h), &written);
+    h.root = written;
+    ok = ok && put(out, root, strlen(root) + 1, &written) && align(out, &written);
+    h.entries = written;
+    uint64_t name = 0;
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        file_entry e = {.mtime = records[i].mtime, .size = records[i].size, .name = name};
+        name += strlen(records[i].path) + 1;
+        ok = put(out, &e, sizeof(e), &written);
+    }
+    h.names = written;
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        ok = put(out, records[i].path, strlen(records[i].path) + 1, &written);
+    }
+    ok = ok && align(out, &written);
+
+    //each list is rewritten as gaps, and its entry now points at where in the postings that starts
+    h.postings = written;
+    for (uint32_t n = 0; ok && n < trigrams; n++)
+    {
+        const uint32_t *list = files + table[n].offset;
+        table[n].offset = written - h.postings;
+        uint32_t previous = 0;
+        for (uint32_t k = 0; ok && k < table[n].count; k++)
+        {
+            unsigned char bytes[5];
+            int length = 0;
+            for (uint32_t gap = list[k] - previous; ; gap >>= 7)
+            {
+                bytes[length++] = (gap & 0x7f) | (gap >= 0x80 ? 0x80 : 0);
+                if (gap < 0x80)
+                {
+                    break;
+                }
+            }
+            previous = list[k];
+            ok = put(out, bytes, length, &written);
+        }
+    }
+    ok = ok && align(out, &written);
+    h.table = written;
+    ok = ok && put(out, table, trigrams * sizeof(trigram_entry), &written);
+    h.size = written;
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, out) == 1;
+    free(table);
+    free(files);
+    return ok;
+}
+
+// Indexes every regular file under root on threads, writing the index to path
+bool build_index(const char *path, const char *root, const trigram_index *old, int threads)
+{
+    //files are recorded relative to the root, which is recorded absolutely
+    char *real = realpath(root, NULL);
+    char *top;
+    if (real == NULL || asprintf(&top, "%s%s", real, real[strlen(real) - 1] == '/' ? "" : "/") < 0)
+    {
+        free(real);
+        return false;
+    }
+    free(real);
+
+    builder b = {.old = old, .root_length = strlen(top)};
+    pthread_mutex_init(&b.lock, NULL);
+    atomic_init(&b.ok, true);
+    bool ok = walk(top, threads, index_entry, &b) && atomic_load(&b.ok);
+    pthread_mutex_destroy(&b.lock);
+    while (b.spare != NULL)
+    {
+        scratch *s = b.spare;
+        b.spare = s->next;
+        free(s->seen);
+        free(s->list);
+        free(s);
+    }
+
+    //the new index replaces the old one only once it's complete
+    if (b.count > 0)
+    {
+        qsort(b.records, b.count, sizeof(record), by_path);
+    }
+    ok = ok && (old == NULL || reuse_trigrams(old, b.records, b.count));
+    char *temporary;
+    if (ok && asprintf(&temporary, "%s.tmp", path) >= 0)
+    {
+        FILE *out = fopen(temporary, "w");
+        ok = out != NULL && write_index(out, top, b.records, b.count);
+        ok = out != NULL && fclose(out) == 0 && ok;
+        ok = ok && rename(temporary, path) == 0;
+        if (!ok)
+        {
+            unlink(temporary);
+        }
+        free(temporary);
+    }
+    else
+    {
+        ok = false;
+    }
+
+    for (size_t i = 0; i < b.count; i++)
+    {
+        free(b.records[i].trigrams);
+    }
+    free(b.records);
+    arena_free(&b.paths);
+    free(top);
+    return ok;
+}
+
+// Marks the files that have every trigram of key, or all of them if key is too short to have any
+static bool mark_candidates(const trigram_index *x, const char *key, size_t length, bool *wanted)
+{
+    if (length < 3)
+    {
+        memset(wanted, true, x->header->files);
+        return true;
+    }
+
+    //the rarest trigram narrows the files down the most, so the others only filter what it leaves
+    const trigram_entry **entries = malloc((length - 2) * sizeof(trigram_entry *));
+    if (entries == NULL)
+    {
+        return false;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i + 2 < length; i++)
+    {
+        uint32_t t = (unsigned char) key[i] << 16 | (unsigned char) key[i + 1] << 8 | (unsigned char) key[i + 2];
+        const trigram_entry *e = find_trigram(x, t);
+        if (e == NULL)
+        {
+            free(entries);
+            return true;
+        }
+        entries[n++] = e;
+        for (size_t j = n - 1; j > 0 && entries[j]->count < entries[j - 1]->count; j--)
+        {
+            const trigram_entry *swap = entries[j];
+            entries[j] = entries[j - 1];
+            entries[j - 1] = swap;
+        }
+    }
+
+    uint32_t *files = malloc(entries[0]->count * sizeof(uint32_t));
+    if (files == NULL)
+    {
+        free(entries);
+        return false;
+    }
+    const unsigned char *p = x->postings + entries[0]->offset;
+    size_t count = entries[0]->count;
+    bool ok = true;
+    uint32_t first = 0;
+    for (size_t k = 0; ok && k < count; k++)
+    {
+        ok = next_file(x, &p, &first);
+        files[k] = first;
+    }
+    for (size_t e = 1; ok && e < n && count > 0; e++)
+    {
+        //both lists are ascending, so they're intersected in one pass
+        p = x->postings + entries[e]->offset;
+        uint32_t f = 0;
+        uint32_t left = entries[e]->count;
+        size_t kept = 0;
+        for (size_t k = 0; ok && k < count && left > 0;)
+        {
+            ok = next_file(x, &p, &f);
+            left--;
+            while (k < count && files[k] < f)
+            {
+                k++;
+            }
+            if (k < count && files[k] == f)
+            {
+                files[kept++] = f;
+                k++;
+            }
+        }
+        count = kept;
+    }
+    for (size_t k = 0; ok && k < count; k++)
+    {
+        wanted[files[k]] = true;
+    }
+    free(files);
+    free(entries);
+    return ok;
+}
+
+// Searches candidates claimed one at a time from the shared job
+static void *query_worker(void *arg)
+{
+    query_job *job = arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count)
+    {
+        job->found(job->top, job->x->names + job->x->entries[job->files[i]].name, job->arg);
+    }
+    return NULL;
+}
+
+// Calls found on threads for each indexed file that could contain one of p's patterns
+bool search_index(const trigram_index *x, const patterns *p, int threads, visit found, void *arg)
+{
+    uint32_t files = x->header->files;
+    bool *wanted = calloc(files ? files : 1, sizeof(bool));
+    if (wanted == NULL)
+    {
+        return false;
+    }
+    bool ok = true;
+    for (int k = 0; ok && k < p->count; k++)
+    {
+        ok = mark_candidates(x, p->list[k], p->lengths[k], wanted);
+    }
+
+    //candidates are opened by their paths relative to the root, and searched in path order
+    query_job job = {.x = x, .found = found, .arg = arg};
+    atomic_init(&job.next, 0);
+    job.files = malloc((files ? files : 1) * sizeof(uint32_t));
+    folder top = {.fd = open(index_root(x), O_RDONLY | O_DIRECTORY | O_CLOEXEC), .path = strdup(index_root(x))};
+    atomic_init(&top.refs, 1);
+    job.top = &top;
+    ok = ok && job.files != NULL && top.fd >= 0 && top.path != NULL;
+    for (uint32_t f = 0; ok && f < files; f++)
+    {
+        if (wanted[f])
+        {
+            job.files[job.count++] = f;
+        }
+    }
+    free(wanted);
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    pthread_t *tids = ok ? calloc(threads, sizeof(pthread_t)) : NULL;
+    ok = ok && tids != NULL;
+
+    //workers claim candidates one at a time, so fewer threads than asked for just search more each,
+    //and if none start this thread searches them all
+    int started = 0;
+    while (ok && started < threads && pthread_create(&tids[started], NULL, query_worker, &job) == 0)
+    {
+        started++;
+    }
+    if (ok && started == 0)
+    {
+        query_worker(&job);
+    }
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    free(job.files);
+    free(top.path);
+    if (top.fd >= 0)
+    {
+        close(top.fd);
+    }
+    return ok;
+}
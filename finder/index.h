@@ -0,0 +1,88 @@
+// A persistent trigram index of a directory tree
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "patterns.h"
+#include "walk.h"
+
+// Identifies an index file, and which layout it has
+#define INDEX_MAGIC 0x58444e46
+#define INDEX_VERSION 1
+
+// How an index file begins, with the offset of each section after it
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t files;
+    uint32_t trigrams;
+    uint64_t root;
+    uint64_t entries;
+    uint64_t names;
+    uint64_t table;
+    uint64_t postings;
+    uint64_t size;
+}
+index_header;
+
+// An indexed file: when it was last modified in nanoseconds, its size, and where its path
+// relative to the root starts among the names. Files are sorted by path
+typedef struct
+{
+    int64_t mtime;
+    int64_t size;
+    uint64_t name;
+}
+file_entry;
+
+// A trigram, how many files contain it, and where in the postings the list of those files starts.
+// Each list is of the gaps between ascending file numbers, written 7 bits a byte with the high bit
+// set on all but the last. Trigrams are sorted and spanning lines aren't indexed
+typedef struct
+{
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t offset;
+}
+trigram_entry;
+
+// An index file mapped into memory
+typedef struct
+{
+    int fd;
+    const unsigned char *data;
+    size_t size;
+    const index_header *header;
+    const file_entry *entries;
+    const char *names;
+    const trigram_entry *table;
+    const unsigned char *postings;
+}
+trigram_index;
+
+// Maps the index at path into memory, returns false if it can't be opened or isn't an index
+bool open_index(trigram_index *x, const char *path);
+
+// Unmaps an index and closes its file
+void close_index(trigram_index *x);
+
+// Returns the absolute path of the directory an index covers, ending in a slash
+const char *index_root(const trigram_index *x);
+
+// Indexes every regular file under root on threads, writing the index to path. If old isn't NULL,
+// files whose modification time and size haven't changed since it was built aren't read again,
+// and files that can't be read are left out. Returns false if root can't be walked,
+// the index can't be written or memory runs out
+bool build_index(const char *path, const char *root, const trigram_index *old, int threads);
+
+// Calls found on threads for each indexed file that has every trigram of at least one of p's patterns,
+// or for every file if a pattern is too short to have one. Returns false if the root can't be opened
+// or memory runs out
+bool search_index(const trigram_index *x, const patterns *p, int threads, visit found, void *arg);
+
+#endif // INDEX_H
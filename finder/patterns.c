@@ -0,0 +1,279 @@
+// Matching of many patterns in one pass
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PATTERNS_X86
+#endif
+
+#include "patterns.h"
+
+// Compiles count non-empty patterns, which the compiled set keeps pointing at
+bool compile_patterns(patterns *p, char **list, int count)
+{
+    memset(p, 0, sizeof(patterns));
+    p->count = count;
+    p->list = list;
+    p->lengths = malloc(count * sizeof(size_t));
+    if (p->lengths == NULL)
+    {
+        return false;
+    }
+
+    //bytes no pattern uses all share class 0, so the table is only as wide as the patterns' alphabet
+    size_t total = 0;
+    size_t shortest = SIZE_MAX;
+    for (int k = 0; k < count; k++)
+    {
+        p->lengths[k] = strlen(list[k]);
+        if (p->lengths[k] == 0 || memchr(list[k], '\n', p->lengths[k]) != NULL)
+        {
+            free_patterns(p);
+            return false;
+        }
+        for (size_t i = 0; i < p->lengths[k]; i++)
+        {
+            unsigned char c = list[k][i];
+            if (p->class[c] == 0)
+            {
+                p->class[c] = ++p->classes;
+            }
+        }
+        total += p->lengths[k];
+        shortest = (p->lengths[k] < shortest) ? p->lengths[k] : shortest;
+    }
+    p->classes++;
+
+    //the trie has a state for every prefix, and -1 marks a transition still to be filled in
+    p->next = malloc((total + 1) * p->classes * sizeof(int));
+    p->out = malloc((total + 1) * sizeof(int));
+    p->link = malloc((total + 1) * sizeof(int));
+    int *fail = malloc((total + 1) * sizeof(int));
+    int *queue = malloc((total + 1) * sizeof(int));
+    if (p->next == NULL || p->out == NULL || p->link == NULL || fail == NULL || queue == NULL)
+    {
+        free(fail);
+        free(queue);
+        free_patterns(p);
+        return false;
+    }
+    memset(p->next, -1, (total + 1) * p->classes * sizeof(int));
+    p->states = 1;
+    p->out[0] = -1;
+    for (int k = 0; k < count; k++)
+    {
+        int s = 0;
+        for (size_t i = 0; i < p->lengths[k]; i++)
+        {
+            int *t = &p->next[s * p->classes + p->class[(unsigned char) list[k][i]]];
+            if (*t < 0)
+            {
+                p->out[p->states] = -1;
+                *t = p->states++;
+            }
+            s = *t;
+        }
+
+        //a repeated pattern is matched as the first of them
+        if (p->out[s] < 0)
+        {
+            p->out[s] = k;
+        }
+    }
+
+    //breadth first, each state's failure is a shallower state whose transitions are already complete,
+    //so missing ones can be copied from it to make every transition a single lookup
+    int head = 0;
+    int tail = 0;
+    fail[0] = 0;
+    p->link[0] = -1;
+    for (int c = 0; c < p->classes; c++)
+    {
+        int *t = &p->next[c];
+        if (*t < 0)
+        {
+            *t = 0;
+            continue;
+        }
+        fail[*t] = 0;
+        p->link[*t] = -1;
+        queue[tail++] = *t;
+    }
+    while (head < tail)
+    {
+        int s = queue[head++];
+        for (int c = 0; c < p->classes; c++)
+        {
+            int *t = &p->next[s * p->classes + c];
+            int f = p->next[fail[s] * p->classes + c];
+            if (*t < 0)
+            {
+                *t = f;
+                continue;
+            }
+            fail[*t] = f;
+            p->link[*t] = (p->out[f] >= 0) ? f : p->link[f];
+            queue[tail++] = *t;
+        }
+    }
+    free(fail);
+    free(queue);
+
+    //small sets are spread over buckets by their first few bytes' nibbles
+    p->teddy = count > 1 && count <= TEDDY_MAX;
+    p->width = (shortest < 3) ? shortest : 3;
+    for (int k = 0; p->teddy && k < count; k++)
+    {
+        int b = k % BUCKETS;
+        p->bucket[b][p->bucket_size[b]++] = k;
+        for (int n = 0; n < p->width; n++)
+        {
+            unsigned char c = list[k][n];
+            p->lo[n][c & 15] |= 1 << b;
+            p->hi[n][c >> 4] |= 1 << b;
+        }
+    }
+    return true;
+}
+
+// Frees a compiled set of patterns
+void free_patterns(patterns *p)
+{
+    free(p->lengths);
+    free(p->next);
+    free(p->out);
+    free(p->link);
+    memset(p, 0, sizeof(patterns));
+}
+
+// Returns the pattern that the match ending in state s is for, if there is one
+static inline int output(const patterns *p, int s)
+{
+    return (p->out[s] >= 0) ? p->out[s] : (p->link[s] >= 0) ? p->out[p->link[s]] : -1;
+}
+
+// Runs the automaton over data until a match ends, returning where it starts or size
+static size_t find_automaton(const patterns *p, const char *data, size_t size)
+{
+    int s = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        s = p->next[s * p->classes + p->class[(unsigned char) data[i]]];
+        int k = output(p, s);
+        if (k >= 0)
+        {
+            return i + 1 - p->lengths[k];
+        }
+    }
+    return size;
+}
+
+#ifdef PATTERNS_X86
+// Looks up 16 positions at a time in each bucket's nibble masks for the patterns' first width bytes,
+// comparing whole patterns only where some bucket has all of them. Returns the first match's start,
+// or size with *next at the first position it didn't check
+__attribute__((target("ssse3")))
+static size_t find_teddy(const patterns *p, const char *data, size_t size, size_t *next)
+{
+    __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i lo[3];
+    __m128i hi[3];
+    for (int n = 0; n < p->width; n++)
+    {
+        lo[n] = _mm_loadu_si128((const __m128i *) p->lo[n]);
+        hi[n] = _mm_loadu_si128((const __m128i *) p->hi[n]);
+    }
+
+    size_t i = 0;
+    for (; i + p->width - 1 + 16 <= size; i += 16)
+    {
+        __m128i m = _mm_set1_epi8(-1);
+        for (int n = 0; n < p->width; n++)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *) (data + i + n));
+            __m128i l = _mm_shuffle_epi8(lo[n], _mm_and_si128(v, nibble));
+            __m128i h = _mm_shuffle_epi8(hi[n], _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+            m = _mm_and_si128(m, _mm_and_si128(l, h));
+        }
+        unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128())) & 0xffff;
+        if (mask == 0)
+        {
+            continue;
+        }
+
+        unsigned char buckets[16];
+        _mm_storeu_si128((__m128i *) buckets, m);
+        for (; mask != 0; mask &= mask - 1)
+        {
+            int bit = __builtin_ctz(mask);
+            size_t at = i + bit;
+            for (unsigned b = buckets[bit]; b != 0; b &= b - 1)
+            {
+                int bucket = __builtin_ctz(b);
+                for (int j = 0; j < p->bucket_size[bucket]; j++)
+                {
+                    int k = p->bucket[bucket][j];
+                    if (p->lengths[k] <= size - at && memcmp(data + at, p->list[k], p->lengths[k]) == 0)
+                    {
+                        return at;
+                    }
+                }
+            }
+        }
+    }
+    *next = i;
+    return size;
+}
+#endif
+
+// Returns where the first match of any pattern in data starts, or size if there's none
+size_t find_any(const patterns *p, const char *data, size_t size)
+{
+    size_t next = 0;
+#ifdef PATTERNS_X86
+    if (p->teddy && __builtin_cpu_supports("ssse3"))
+    {
+        size_t at = find_teddy(p, data, size, &next);
+        if (at < size)
+        {
+            return at;
+        }
+    }
+#endif
+
+    //matches wholly after next are all that's left
+    return next + find_automaton(p, data + next, size - next);
+}
+
+// Finds every pattern in text, in order of where their first match ends
+int match_line(const patterns *p, const char *text, size_t length, bool *seen, int *which, size_t *columns)
+{
+    int found = 0;
+    int s = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        s = p->next[s * p->classes + p->class[(unsigned char) text[i]]];
+
+        //every pattern ending here is on the chain of dictionary links
+        for (int t = (p->out[s] >= 0) ? s : p->link[s]; t >= 0; t = p->link[t])
+        {
+            int k = p->out[t];
+            if (!seen[k])
+            {
+                seen[k] = true;
+                which[found] = k;
+                columns[found++] = i + 1 - p->lengths[k];
+            }
+        }
+    }
+    for (int f = 0; f < found; f++)
+    {
+        seen[which[f]] = false;
+    }
+    return found;
+}
@@ -0,0 +1,52 @@
+// Matching of many patterns in one pass
+
+#ifndef PATTERNS_H
+#define PATTERNS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Most patterns the SIMD prefilter takes, and how many groups it sorts them into
+#define TEDDY_MAX 32
+#define BUCKETS 8
+
+// Patterns compiled into an Aho-Corasick automaton over classes of the bytes they use, and for small
+// sets a Teddy prefilter: nibble masks of each bucket's first few bytes that rule out most positions
+typedef struct
+{
+    int count;
+    char **list;
+    size_t *lengths;
+
+    int classes;
+    unsigned char class[256];
+    int states;
+    int *next;
+    int *out;
+    int *link;
+
+    bool teddy;
+    int width;
+    unsigned char lo[3][16];
+    unsigned char hi[3][16];
+    int bucket[BUCKETS][TEDDY_MAX];
+    int bucket_size[BUCKETS];
+}
+patterns;
+
+// Compiles count non-empty patterns, which the compiled set keeps pointing at.
+// Returns false if one is empty or spans lines, or memory runs out
+bool compile_patterns(patterns *p, char **list, int count);
+
+// Frees a compiled set of patterns
+void free_patterns(patterns *p);
+
+// Returns where the first match of any pattern in data starts, or size if there's none. Among overlapping
+// matches, first may be by where they end, but that's always on the same line
+size_t find_any(const patterns *p, const char *data, size_t size);
+
+// Finds every pattern in text, storing them in which in order of where their first match ends, with where
+// that match starts in columns. seen holds a false for each pattern, and does again after. Returns how many
+int match_line(const patterns *p, const char *text, size_t length, bool *seen, int *which, size_t *columns);
+
+#endif // PATTERNS_H
@@ -0,0 +1,265 @@
+// Searching of files for patterns
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86
+#endif
+
+#include "search.h"
+
+// Files smaller than this are read into a buffer rather than mapped
+#define SMALL (64 << 10)
+
+// What search_file passes through with_file
+typedef struct
+{
+    const patterns *p;
+    on_line report;
+    void *arg;
+}
+search_call;
+
+#ifdef SEARCH_X86
+// Checks 32 candidate starts at a time against key's first and last bytes, comparing the rest only
+// where both match. Returns the first match, or size with *next at the first start it didn't check
+__attribute__((target("avx2")))
+static size_t find_avx2(const char *data, size_t size, const char *key, size_t length, size_t *next)
+{
+    __m256i first = _mm256_set1_epi8(key[0]);
+    __m256i last = _mm256_set1_epi8(key[length - 1]);
+    size_t i = 0;
+    for (; i + length - 1 + 32 <= size; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (data + i + length - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(data + at + 1, key + 1, length - 2) == 0)
+            {
+                return at;
+            }
+        }
+    }
+    *next = i;
+    return size;
+}
+
+// The same 16 starts at a time with SSE2, which every x86-64 has
+static size_t find_sse2(const char *data, size_t size, const char *key, size_t length, size_t *next)
+{
+    __m128i first = _mm_set1_epi8(key[0]);
+    __m128i last = _mm_set1_epi8(key[length - 1]);
+    size_t i = 0;
+    for (; i + length - 1 + 16 <= size; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (data + i + length - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(data + at + 1, key + 1, length - 2) == 0)
+            {
+                return at;
+            }
+        }
+    }
+    *next = i;
+    return size;
+}
+
+// Counts the newlines in data[from, to), 16 bytes at a time
+static size_t count_sse2(const char *data, size_t from, size_t to)
+{
+    __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = from;
+    for (; i + 16 <= to; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)));
+    }
+    for (; i < to; i++)
+    {
+        count += data[i] == '\n';
+    }
+    return count;
+}
+#endif
+
+// Returns the offset of the first occurrence of key in data, or size if there's none
+size_t find_key(const char *data, size_t size, const char *key, size_t length)
+{
+    if (length == 0 || length > size)
+    {
+        return size;
+    }
+    if (length == 1)
+    {
+        const char *p = memchr(data, key[0], size);
+        return p ? p - data : size;
+    }
+
+    size_t next = 0;
+#ifdef SEARCH_X86
+    size_t at = __builtin_cpu_supports("avx2") ? find_avx2(data, size, key, length, &next)
+                                               : find_sse2(data, size, key, length, &next);
+    if (at < size)
+    {
+        return at;
+    }
+#endif
+
+    //the last few starts are too close to the end for a whole vector, and without vectors memmem does it all
+    const char *p = memmem(data + next, size - next, key, length);
+    return p ? p - data : size;
+}
+
+// Counts the newlines in data[from, to)
+static size_t count_lines(const char *data, size_t from, size_t to)
+{
+#ifdef SEARCH_X86
+    return count_sse2(data, from, to);
+#else
+    size_t count = 0;
+    for (const char *p = data + from; (p = memchr(p, '\n', data + to - p)) != NULL; p++)
+    {
+        count++;
+    }
+    return count;
+#endif
+}
+
+// Returns where the first match of any of p's patterns in data starts, or size if there's none
+static size_t find_first(const patterns *p, const char *data, size_t size)
+{
+    return (p->count == 1) ? find_key(data, size, p->list[0], p->lengths[0]) : find_any(p, data, size);
+}
+
+// Calls report once for each pattern in p on each line of data it's on
+bool search_lines(const char *data, size_t size, const patterns *p, on_line report, void *arg)
+{
+    //lines are only counted up to each match, so files without one are never counted at all,
+    //nor do they need room to list the patterns on a line
+    bool *seen = NULL;
+    int *which = NULL;
+    size_t *columns = NULL;
+    bool ok = true;
+    size_t number = 1;
+    size_t counted = 0;
+    size_t offset = 0;
+    while (offset < size)
+    {
+        size_t at = offset + find_first(p, data + offset, size - offset);
+        if (at == size)
+        {
+            break;
+        }
+        const char *start = memrchr(data + offset, '\n', at - offset);
+        size_t lo = start ? start - data + 1 : offset;
+        const char *end = memchr(data + at, '\n', size - at);
+        size_t hi = end ? (size_t) (end - data) : size;
+        number += count_lines(data, counted, lo);
+        counted = lo;
+
+        if (seen == NULL)
+        {
+            seen = calloc(p->count, sizeof(bool));
+            which = malloc(p->count * sizeof(int));
+            columns = malloc(p->count * sizeof(size_t));
+            if (seen == NULL || which == NULL || columns == NULL)
+            {
+                ok = false;
+                break;
+            }
+        }
+
+        //the whole line is run through the automaton for every pattern on it
+        int found = match_line(p, data + lo, hi - lo, seen, which, columns);
+        for (int f = 0; f < found; f++)
+        {
+            line l = {.pattern = which[f], .number = number, .column = columns[f] + 1, .text = data + lo, .length = hi - lo};
+            report(&l, arg);
+        }
+
+        //each pattern is reported once a line however many times it's on it
+        offset = hi + 1;
+    }
+    free(seen);
+    free(which);
+    free(columns);
+    return ok;
+}
+
+// Opens the file name in the directory open at dir and passes its contents to use
+bool with_file(int dir, const char *name, struct stat *st, on_contents use, void *arg)
+{
+    int fd = openat(dir, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (fstat(fd, st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    //a mapping costs more to set up than a small file costs to copy
+    bool ok = true;
+    if (st->st_size < SMALL)
+    {
+        char buffer[SMALL];
+        size_t size = 0;
+        ssize_t n;
+        while (size < sizeof(buffer) && (n = read(fd, buffer + size, sizeof(buffer) - size)) != 0)
+        {
+            if (n < 0)
+            {
+                ok = false;
+                break;
+            }
+            size += n;
+        }
+        ok = ok && use(buffer, size, arg);
+    }
+    else
+    {
+        //the whole file is read in as the mapping's made, rather than a fault at a time
+        char *data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        ok = data != MAP_FAILED;
+        if (ok)
+        {
+            ok = use(data, st->st_size, arg);
+            munmap(data, st->st_size);
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+// Searches a file's contents for a search_file call's patterns
+static bool search_contents(const char *data, size_t size, void *arg)
+{
+    search_call *call = arg;
+    return search_lines(data, size, call->p, call->report, call->arg);
+}
+
+// Searches the file name in the directory open at dir
+bool search_file(int dir, const char *name, const patterns *p, on_line report, void *arg)
+{
+    struct stat st;
+    search_call call = {.p = p, .report = report, .arg = arg};
+    return with_file(dir, name, &st, search_contents, &call);
+}
@@ -0,0 +1,45 @@
+// Searching of files for patterns
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "patterns.h"
+
+// A line of a file containing a pattern, numbered from 1, without its newline,
+// and the column, also from 1, where the pattern's first match on it starts
+typedef struct
+{
+    int pattern;
+    size_t number;
+    size_t column;
+    const char *text;
+    size_t length;
+}
+line;
+
+// Called for every pattern on every matching line, in order of lines
+typedef void (*on_line)(const line *l, void *arg);
+
+// Returns the offset of the first occurrence of key in data, or size if there's none
+size_t find_key(const char *data, size_t size, const char *key, size_t length);
+
+// Calls report once for each pattern in p on each line of data it's on.
+// Returns false if memory runs out
+bool search_lines(const char *data, size_t size, const patterns *p, on_line report, void *arg);
+
+// Called with the whole contents of a file, returning false if it couldn't use them
+typedef bool (*on_contents)(const char *data, size_t size, void *arg);
+
+// Opens the file name in the directory open at dir, filling in st, then reads it if it's small or maps it
+// if not and passes its contents to use. Returns false if it can't be opened or read, or use fails
+bool with_file(int dir, const char *name, struct stat *st, on_contents use, void *arg);
+
+// Searches the file name in the directory open at dir with with_file.
+// Returns false if it can't be opened or read
+bool search_file(int dir, const char *name, const patterns *p, on_line report, void *arg);
+
+#endif // SEARCH_H
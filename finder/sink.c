@@ -0,0 +1,144 @@
+// A single writer for results pushed by many searching threads
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sink.h"
+
+// How long the writer sleeps when nothing's queued, letting the next batch build up
+#define IDLE_NS 1000000
+
+// Writes a result out, or keeps it for sorting, then frees what's written
+static void take(sink *s, result *r)
+{
+    if (!s->sorted)
+    {
+        s->ok = fwrite(r->text, 1, r->size, s->out) == r->size && s->ok;
+        free(r->text);
+        free(r);
+        return;
+    }
+    if (s->count == s->capacity)
+    {
+        size_t capacity = s->capacity ? s->capacity * 2 : 1024;
+        result **kept = realloc(s->kept, capacity * sizeof(result *));
+        if (kept == NULL)
+        {
+            s->ok = false;
+            free(r->text);
+            free(r);
+            return;
+        }
+        s->kept = kept;
+        s->capacity = capacity;
+    }
+    s->kept[s->count++] = r;
+}
+
+// Orders results by path
+static int by_path(const void *a, const void *b)
+{
+    return strcmp((*(result *const *) a)->path, (*(result *const *) b)->path);
+}
+
+// Takes everything queued at once, again and again, until the sink closes with nothing left
+static void *write_results(void *arg)
+{
+    sink *s = arg;
+    while (true)
+    {
+        //closing is checked first, so an empty queue after it means nothing more can come
+        bool closing = atomic_load(&s->closing);
+        result *r = atomic_exchange(&s->head, NULL);
+        if (r == NULL)
+        {
+            if (closing)
+            {
+                break;
+            }
+            nanosleep(&(struct timespec) {.tv_nsec = IDLE_NS}, NULL);
+            continue;
+        }
+
+        //the queue comes out newest first, so it's reversed into the order results arrived in
+        result *batch = NULL;
+        while (r != NULL)
+        {
+            result *next = r->next;
+            r->next = batch;
+            batch = r;
+            r = next;
+        }
+        while (batch != NULL)
+        {
+            result *next = batch->next;
+            take(s, batch);
+            batch = next;
+        }
+    }
+
+    if (s->sorted)
+    {
+        if (s->count > 0)
+        {
+            qsort(s->kept, s->count, sizeof(result *), by_path);
+        }
+        for (size_t i = 0; i < s->count; i++)
+        {
+            s->ok = fwrite(s->kept[i]->text, 1, s->kept[i]->size, s->out) == s->kept[i]->size && s->ok;
+            free(s->kept[i]->text);
+            free(s->kept[i]);
+        }
+        free(s->kept);
+    }
+    s->ok = fflush(s->out) == 0 && s->ok;
+    return NULL;
+}
+
+// Starts a thread writing results to out
+bool sink_open(sink *s, FILE *out, bool sorted)
+{
+    memset(s, 0, sizeof(sink));
+    s->out = out;
+    s->sorted = sorted;
+    s->ok = true;
+    atomic_init(&s->head, NULL);
+    atomic_init(&s->closing, false);
+    setvbuf(out, NULL, _IOFBF, SINK_BUFFER);
+    return pthread_create(&s->writer, NULL, write_results, s) == 0;
+}
+
+// Queues a file's results without locking
+bool sink_push(sink *s, const char *dir, const char *name, char *text, size_t size)
+{
+    size_t prefix = strlen(dir);
+    size_t length = strlen(name);
+    result *r = malloc(sizeof(result) + prefix + length + 1);
+    if (r == NULL)
+    {
+        free(text);
+        return false;
+    }
+    memcpy(r->path, dir, prefix);
+    memcpy(r->path + prefix, name, length + 1);
+    r->text = text;
+    r->size = size;
+
+    //a failed exchange reloads the head into r->next, so each retry links to the latest
+    r->next = atomic_load(&s->head);
+    while (!atomic_compare_exchange_weak(&s->head, &r->next, r))
+    {
+    }
+    return true;
+}
+
+// Writes what's still queued and stops the writer
+bool sink_close(sink *s)
+{
+    atomic_store(&s->closing, true);
+    pthread_join(s->writer, NULL);
+    return s->ok;
+}
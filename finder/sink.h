@@ -0,0 +1,52 @@
+// A single writer for results pushed by many searching threads
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Bytes the output is buffered in, so it's written in large batches
+#define SINK_BUFFER (1 << 20)
+
+// One file's formatted results on their way out, linked newest first while they're queued
+typedef struct result
+{
+    struct result *next;
+    char *text;
+    size_t size;
+    char path[];
+}
+result;
+
+// Results queued by any number of threads without locking, and the thread writing them out.
+// If sorted, they're kept until the sink is closed and written in order of path
+typedef struct
+{
+    FILE *out;
+    bool sorted;
+    _Atomic(result *) head;
+    atomic_bool closing;
+    pthread_t writer;
+    result **kept;
+    size_t count;
+    size_t capacity;
+    bool ok;
+}
+sink;
+
+// Starts a thread writing results to out, returns false if it can't
+bool sink_open(sink *s, FILE *out, bool sorted);
+
+// Queues size bytes of text, which the sink takes and frees, for the file name in the directory at dir.
+// Returns false if memory runs out
+bool sink_push(sink *s, const char *dir, const char *name, char *text, size_t size);
+
+// Writes what's still queued once every thread has stopped pushing, and stops the writer.
+// Returns false if anything couldn't be written
+bool sink_close(sink *s);
+
+#endif // SINK_H
@@ -0,0 +1,362 @@
+// Parallel traversal of a directory tree
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "walk.h"
+
+// Bytes of directory entries read per getdents64 call
+#define LISTING (32 << 10)
+
+// Rounds of failed stealing an idle thread yields through before it starts sleeping
+#define SPINS 64
+
+// A directory entry as getdents64 returns it
+typedef struct
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+}
+raw_entry;
+
+// A directory to list or a file to search, named relative to the folder it was found in
+typedef struct
+{
+    folder *dir;
+    char *name;
+    bool is_dir;
+}
+task;
+
+// One thread's tasks: it pushes and pops at the tail, the others steal from the head
+typedef struct
+{
+    pthread_mutex_t lock;
+    task *tasks;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+}
+deque;
+
+// Shared state of the walking threads
+typedef struct
+{
+    deque *queues;
+    int threads;
+    atomic_size_t pending;
+    atomic_bool ok;
+    visit found;
+    void *arg;
+}
+walker;
+
+// One walking thread
+typedef struct
+{
+    walker *w;
+    int id;
+}
+worker;
+
+// Appends a task to the tail of q, doubling its capacity as needed
+static bool push(deque *q, task t)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->tail - q->head == q->capacity)
+    {
+        //the ring is unrolled into the new array so indices start over at 0
+        size_t capacity = q->capacity ? q->capacity * 2 : 256;
+        task *tasks = malloc(capacity * sizeof(task));
+        if (tasks == NULL)
+        {
+            pthread_mutex_unlock(&q->lock);
+            return false;
+        }
+        for (size_t i = q->head; i < q->tail; i++)
+        {
+            tasks[i - q->head] = q->tasks[i % q->capacity];
+        }
+        free(q->tasks);
+        q->tasks = tasks;
+        q->tail -= q->head;
+        q->head = 0;
+        q->capacity = capacity;
+    }
+    q->tasks[q->tail++ % q->capacity] = t;
+    pthread_mutex_unlock(&q->lock);
+    return true;
+}
+
+// Takes the newest task from q, so its owner goes depth first and keeps few directories open
+static bool pop(deque *q, task *t)
+{
+    pthread_mutex_lock(&q->lock);
+    bool found = q->tail > q->head;
+    if (found)
+    {
+        *t = q->tasks[--q->tail % q->capacity];
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+// Takes the oldest task from another thread's queue, which is likely the biggest piece of the tree
+static bool steal(walker *w, int id, task *t)
+{
+    for (int k = 1; k < w->threads; k++)
+    {
+        deque *q = &w->queues[(id + k) % w->threads];
+        pthread_mutex_lock(&q->lock);
+        bool found = q->tail > q->head;
+        if (found)
+        {
+            *t = q->tasks[q->head++ % q->capacity];
+        }
+        pthread_mutex_unlock(&q->lock);
+        if (found)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drops a reference to a folder, closing and freeing it once nothing queued is still in it
+static void release(folder *dir)
+{
+    if (atomic_fetch_sub(&dir->refs, 1) == 1)
+    {
+        close(dir->fd);
+        arena_free(&dir->names);
+        free(dir);
+    }
+}
+
+// Makes a folder for the directory name in the one at parent, its path ending in a slash, that isn't open yet
+static folder *make_folder(const char *parent, const char *name)
+{
+    size_t prefix = strlen(parent);
+    size_t length = strlen(name);
+    bool slash = length == 0 || name[length - 1] != '/';
+    folder *dir = malloc(sizeof(folder) + prefix + length + slash + 1);
+    if (dir == NULL)
+    {
+        return NULL;
+    }
+    dir->fd = -1;
+    dir->path = (char *) (dir + 1);
+    memcpy(dir->path, parent, prefix);
+    memcpy(dir->path + prefix, name, length);
+    strcpy(dir->path + prefix + length, slash ? "/" : "");
+    dir->names = (arena) {0};
+    atomic_init(&dir->refs, 1);
+    return dir;
+}
+
+// Lists dir, queueing its subdirectories and regular files on thread id's queue
+static void expand(walker *w, int id, folder *dir)
+{
+    char buffer[LISTING] __attribute__((aligned(8)));
+    long n = 0;
+    while (atomic_load(&w->ok) && (n = syscall(SYS_getdents64, dir->fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (long at = 0; at < n;)
+        {
+            raw_entry *e = (raw_entry *) (buffer + at);
+            at += e->d_reclen;
+            if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            {
+                continue;
+            }
+
+            //some filesystems don't report types, so those are looked up
+            unsigned char type = e->d_type;
+            struct stat st;
+            if (type == DT_UNKNOWN && fstatat(dir->fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            {
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if (type != DT_DIR && type != DT_REG)
+            {
+                continue;
+            }
+
+            //counted before it's queued, so the walk can't look finished while it waits
+            task t = {.dir = dir, .name = arena_copy(&dir->names, e->d_name, strlen(e->d_name)), .is_dir = type == DT_DIR};
+            atomic_fetch_add(&dir->refs, 1);
+            atomic_fetch_add(&w->pending, 1);
+            if (t.name == NULL || !push(&w->queues[id], t))
+            {
+                atomic_fetch_sub(&dir->refs, 1);
+                atomic_fetch_sub(&w->pending, 1);
+                atomic_store(&w->ok, false);
+                return;
+            }
+        }
+    }
+    if (n < 0)
+    {
+        fprintf(stderr, "Could not list %s.\n", dir->path);
+    }
+}
+
+// Opens and lists the subdirectory named by t
+static void descend(walker *w, int id, task *t)
+{
+    folder *dir = make_folder(t->dir->path, t->name);
+    if (dir == NULL)
+    {
+        atomic_store(&w->ok, false);
+        return;
+    }
+    dir->fd = openat(t->dir->fd, t->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir->fd < 0)
+    {
+        fprintf(stderr, "Could not open %s.\n", dir->path);
+        free(dir);
+        return;
+    }
+    expand(w, id, dir);
+    release(dir);
+}
+
+// Runs tasks from this thread's queue, or stolen from others, until the whole tree is done
+static void *walk_worker(void *arg)
+{
+    worker *self = arg;
+    walker *w = self->w;
+    int idle = 0;
+    while (atomic_load(&w->pending) > 0)
+    {
+        task t;
+        if (!pop(&w->queues[self->id], &t) && !steal(w, self->id, &t))
+        {
+            //work only runs out for good once every queued task has finished
+            if (++idle < SPINS)
+            {
+                sched_yield();
+            }
+            else
+            {
+                nanosleep(&(struct timespec) {.tv_nsec = 50000}, NULL);
+            }
+            continue;
+        }
+        idle = 0;
+
+        //after running out of memory, what's queued is only released
+        if (atomic_load(&w->ok))
+        {
+            if (t.is_dir)
+            {
+                descend(w, self->id, &t);
+            }
+            else
+            {
+                w->found(t.dir, t.name, w->arg);
+            }
+        }
+        release(t.dir);
+        atomic_fetch_sub(&w->pending, 1);
+    }
+    return NULL;
+}
+
+// Walks the tree under root on threads, calling found for every regular file
+bool walk(const char *root, int threads, visit found, void *arg)
+{
+    //a directory stays open while its entries are queued, so allow as many open files as we may
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    //names are joined straight onto their folder's path
+    folder *top = make_folder("", root);
+    if (top == NULL)
+    {
+        return false;
+    }
+    top->fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (top->fd < 0)
+    {
+        free(top);
+        return false;
+    }
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    walker w = {.threads = threads, .found = found, .arg = arg};
+    atomic_init(&w.pending, 0);
+    atomic_init(&w.ok, true);
+    w.queues = calloc(threads, sizeof(deque));
+    worker *workers = calloc(threads, sizeof(worker));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if (w.queues == NULL || workers == NULL || tids == NULL)
+    {
+        free(w.queues);
+        free(workers);
+        free(tids);
+        release(top);
+        return false;
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        pthread_mutex_init(&w.queues[t].lock, NULL);
+    }
+
+    //the root is listed up front, and the threads spread out from there
+    expand(&w, 0, top);
+    release(top);
+    //threads steal from every queue, so those that start share out the work of those that don't.
+    //If none start the walk fails, and this thread just releases what the root queued
+    int started = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        workers[t] = (worker) {.w = &w, .id = t};
+    }
+    while (started < threads && pthread_create(&tids[started], NULL, walk_worker, &workers[started]) == 0)
+    {
+        started++;
+    }
+    if (started == 0)
+    {
+        fprintf(stderr, "Could not start the walking threads.\n");
+        atomic_store(&w.ok, false);
+        walk_worker(&workers[0]);
+    }
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        pthread_mutex_destroy(&w.queues[t].lock);
+        free(w.queues[t].tasks);
+    }
+    free(w.queues);
+    free(workers);
+    free(tids);
+    return atomic_load(&w.ok);
+}
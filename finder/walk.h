@@ -0,0 +1,31 @@
+// Parallel traversal of a directory tree
+
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "arena.h"
+
+// A directory that has been listed, kept open while any of its entries are still queued
+// so they can be opened relative to it. Its path is allocated with it and its entries' names
+// in its own arena, so they're all freed together once the last entry is done
+typedef struct
+{
+    int fd;
+    char *path;
+    arena names;
+    atomic_int refs;
+}
+folder;
+
+// Called on a walking thread for each regular file found, with the folder it's in and its name there
+typedef void (*visit)(const folder *dir, const char *name, void *arg);
+
+// Walks the tree under root on threads, calling found for every regular file as soon as it's listed.
+// Each thread lists and searches from its own queue, stealing from the others' when it runs dry.
+// Symbolic links aren't followed. Returns false if root can't be opened or memory runs out
+bool walk(const char *root, int threads, visit found, void *arg);
+
+#endif // WALK_H
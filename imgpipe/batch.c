@@ -0,0 +1,345 @@
+// Running imgpipe over many files at once
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "bmpio.h"
+
+// Shared state of the batch's threads
+typedef struct
+{
+    batch *b;
+    int threads;
+    atomic_size_t next;
+    atomic_size_t failed;
+}
+batch_job;
+
+// Empties a batch
+void batch_init(batch *b)
+{
+    memset(b, 0, sizeof(batch));
+}
+
+// Appends an entry for in and out, taking ownership of both, doubling b's capacity as needed
+static bool push_entry(batch *b, char *in, char *out, const plan *p, int status)
+{
+    if (b->count == b->capacity)
+    {
+        size_t capacity = b->capacity ? b->capacity * 2 : 64;
+        entry *entries = realloc(b->entries, capacity * sizeof(entry));
+        if (entries == NULL)
+        {
+            free(in);
+            free(out);
+            return false;
+        }
+        b->entries = entries;
+        b->capacity = capacity;
+    }
+    b->entries[b->count++] = (entry) {.in = in, .out = out, .p = p, .status = status};
+    return true;
+}
+
+// Returns the plan for operation, parsing it only the first time it's seen; sets *parsed to false
+// (and returns NULL) if it doesn't parse, or leaves it true and returns NULL if memory runs out
+static const plan *find_plan(batch *b, const char *operation, bool *parsed)
+{
+    *parsed = true;
+    for (size_t i = 0; i < b->nplans; i++)
+    {
+        if (strcmp(b->operations[i], operation) == 0)
+        {
+            *parsed = b->plans[i] != NULL;
+            return b->plans[i];
+        }
+    }
+
+    //operations that don't parse are remembered too, as a NULL plan
+    char **operations = realloc(b->operations, (b->nplans + 1) * sizeof(char *));
+    if (operations != NULL)
+    {
+        b->operations = operations;
+    }
+    plan **plans = realloc(b->plans, (b->nplans + 1) * sizeof(plan *));
+    if (plans != NULL)
+    {
+        b->plans = plans;
+    }
+    char *copy = strdup(operation);
+    plan *p = malloc(sizeof(plan));
+    if (operations == NULL || plans == NULL || copy == NULL || p == NULL)
+    {
+        free(copy);
+        free(p);
+        return NULL;
+    }
+    plan_init(p);
+    if (!parse_operation(p, operation))
+    {
+        free(p);
+        p = NULL;
+        *parsed = false;
+    }
+    b->operations[b->nplans] = copy;
+    b->plans[b->nplans++] = p;
+    return p;
+}
+
+// Returns true if paths a and b both exist and are the same file, through any links
+static bool same_file(const char *a, const char *b)
+{
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+// Adds each line of the manifest at path to b
+bool read_manifest(batch *b, const char *path, const plan *defaults)
+{
+    FILE *manifest = fopen(path, "r");
+    if (manifest == NULL)
+    {
+        fprintf(stderr, "Could not open manifest %s.\n", path);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    bool ok = true;
+    for (size_t number = 1; ok && (length = getline(&line, &size, manifest)) != -1; number++)
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        {
+            line[--length] = '\0';
+        }
+        if (length == 0 || line[0] == '#' || strcmp(line, "input,output,operation") == 0)
+        {
+            continue;
+        }
+
+        //input,output[,operation], the operation being everything after the second comma
+        char *out = strchr(line, ',');
+        char *operation = out ? strchr(out + 1, ',') : NULL;
+        if (out == NULL || out == line || out[1] == '\0' || operation == out + 1)
+        {
+            fprintf(stderr, "Bad entry on line %zu of %s.\n", number, path);
+            ok = push_entry(b, strdup(line), strdup(""), NULL, 1);
+            continue;
+        }
+        *out++ = '\0';
+        if (operation != NULL)
+        {
+            *operation++ = '\0';
+        }
+
+        //writing over an input while it's mapped would destroy it
+        if (same_file(line, out))
+        {
+            fprintf(stderr, "Could not use %s for output from %s.\n", out, line);
+            ok = push_entry(b, strdup(line), strdup(out), NULL, 1);
+            continue;
+        }
+
+        //an operation is parsed once, however many entries use it
+        const plan *p = defaults;
+        bool parsed = true;
+        if (operation != NULL && operation[strspn(operation, " \t")] != '\0')
+        {
+            p = find_plan(b, operation, &parsed);
+            if (p == NULL && parsed)
+            {
+                ok = false;
+                break;
+            }
+            if (!parsed)
+            {
+                fprintf(stderr, "Unknown operation \"%s\" for %s.\n", operation, line);
+            }
+        }
+        char *in_copy = strdup(line), *out_copy = strdup(out);
+        ok = in_copy != NULL && out_copy != NULL && push_entry(b, in_copy, out_copy, p, parsed ? 0 : 1);
+    }
+    free(line);
+    fclose(manifest);
+    return ok;
+}
+
+// Returns true if name ends in .bmp, in any case
+static bool is_bmp(const char *name)
+{
+    size_t length = strlen(name);
+    return length > 4 && strcasecmp(name + length - 4, ".bmp") == 0;
+}
+
+// Orders entries by input path
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const entry *) a)->in, ((const entry *) b)->in);
+}
+
+// Adds every .bmp file in indir to b
+bool list_directory(batch *b, const char *indir, const char *outdir, const plan *p)
+{
+    if (mkdir(outdir, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Could not create %s.\n", outdir);
+        return false;
+    }
+
+    //writing over the inputs while they're mapped would destroy them
+    char in_path[PATH_MAX], out_path[PATH_MAX];
+    if (realpath(indir, in_path) == NULL || realpath(outdir, out_path) == NULL || strcmp(in_path, out_path) == 0)
+    {
+        fprintf(stderr, "Could not use %s for output from %s.\n", outdir, indir);
+        return false;
+    }
+
+    DIR *dir = opendir(indir);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", indir);
+        return false;
+    }
+    size_t first = b->count;
+    bool ok = true;
+    struct dirent *d;
+    while (ok && (d = readdir(dir)) != NULL)
+    {
+        if (!is_bmp(d->d_name))
+        {
+            continue;
+        }
+        char *in, *out;
+        if (asprintf(&in, "%s/%s", indir, d->d_name) < 0)
+        {
+            ok = false;
+            break;
+        }
+        if (asprintf(&out, "%s/%s", outdir, d->d_name) < 0)
+        {
+            free(in);
+            ok = false;
+            break;
+        }
+        ok = push_entry(b, in, out, p, 0);
+    }
+    closedir(dir);
+    if (ok)
+    {
+        qsort(b->entries + first, b->count - first, sizeof(entry), compare_entries);
+    }
+    return ok;
+}
+
+// Runs entries claimed one at a time from the shared job, hinting at the file threads entries ahead
+static void *batch_worker(void *arg)
+{
+    batch_job *job = arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->b->count)
+    {
+        if (i + job->threads < job->b->count)
+        {
+            bmp_prefetch(job->b->entries[i + job->threads].in);
+        }
+        entry *e = &job->b->entries[i];
+        if (e->status == 0)
+        {
+            e->status = run_plan(e->p, e->in, e->out, 1);
+        }
+        if (e->status != 0)
+        {
+            atomic_fetch_add(&job->failed, 1);
+        }
+    }
+    return NULL;
+}
+
+// Runs every entry of b on a pool of threads
+int run_batch(batch *b, int threads)
+{
+    batch_job job = {.b = b};
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, 0);
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if ((size_t) threads > b->count)
+    {
+        threads = b->count ? b->count : 1;
+    }
+    job.threads = threads;
+
+    //the first files are read ahead before any thread starts on them
+    for (size_t i = 0; i < (size_t) threads && i < b->count; i++)
+    {
+        bmp_prefetch(b->entries[i].in);
+    }
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if (tids == NULL)
+    {
+        fprintf(stderr, "Not enough memory.\n");
+        return 5;
+    }
+    //workers claim files one at a time, so fewer threads than asked for just run more each,
+    //and if none start this thread runs them all
+    int started = 0;
+    while (started < threads && pthread_create(&tids[started], NULL, batch_worker, &job) == 0)
+    {
+        started++;
+    }
+    if (started == 0)
+    {
+        batch_worker(&job);
+    }
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+
+    size_t failed = atomic_load(&job.failed);
+    if (failed > 0)
+    {
+        fprintf(stderr, "%zu of %zu files failed.\n", failed, b->count);
+    }
+    for (size_t i = 0; i < b->count; i++)
+    {
+        if (b->entries[i].status != 0)
+        {
+            return b->entries[i].status;
+        }
+    }
+    return 0;
+}
+
+// Frees a batch
+void free_batch(batch *b)
+{
+    for (size_t i = 0; i < b->count; i++)
+    {
+        free(b->entries[i].in);
+        free(b->entries[i].out);
+    }
+    for (size_t i = 0; i < b->nplans; i++)
+    {
+        free(b->operations[i]);
+        free(b->plans[i]);
+    }
+    free(b->entries);
+    free(b->operations);
+    free(b->plans);
+}
@@ -0,0 +1,53 @@
+// Running imgpipe over many files at once
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "plan.h"
+
+// One file of a batch: where it's read from and written to, what's done to it, and how that went
+typedef struct
+{
+    char *in;
+    char *out;
+    const plan *p;
+    int status;
+}
+entry;
+
+// Files to process, and each distinct operation they name, parsed once
+typedef struct
+{
+    entry *entries;
+    size_t count;
+    size_t capacity;
+    char **operations;
+    plan **plans;
+    size_t nplans;
+}
+batch;
+
+// Empties a batch
+void batch_init(batch *b);
+
+// Adds each line of the manifest at path, input,output[,operation], to b. Entries without an operation
+// get defaults; those whose operation doesn't parse are reported and marked failed (status 1).
+// Blank lines, lines starting with # and an input,output,operation header are skipped.
+// Returns false if the manifest can't be read or memory runs out
+bool read_manifest(batch *b, const char *path, const plan *defaults);
+
+// Adds every .bmp file in indir to b, in name order, to be written under the same name in outdir
+// (created if need be) with p. Returns false if either directory can't be used or memory runs out
+bool list_directory(batch *b, const char *indir, const char *outdir, const plan *p);
+
+// Runs every entry of b on a pool of threads, reading ahead of them, and reports how many failed.
+// Returns the status of the first entry that failed, or 0
+int run_batch(batch *b, int threads);
+
+// Frees a batch
+void free_batch(batch *b);
+
+#endif // BATCH_H
@@ -0,0 +1,476 @@
+// Benchmarks imgpipe's operations on synthetic BMPs, checking their output
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bmpio.h"
+#include "plan.h"
+#include "synth.h"
+
+// How to run bench
+const char *USAGE = "Usage: ./bench [-d dir] [-j threads] [-o results.json] [-r repeats] [-s width] [-t height]\n";
+
+// Writes what an operation should produce from in to path, one pixel at a time; returns false if it can't
+typedef bool (*reference)(const bitmap *in, const char *path);
+
+// An operation to measure, as an imgpipe operation, the reference its output must match
+// (NULL to match its own single-threaded output), and how far any channel may be from it
+typedef struct
+{
+    const char *name;
+    const char *operation;
+    reference check;
+    int tolerance;
+}
+operation;
+
+static bool reveal_reference(const bitmap *in, const char *path);
+static bool grayscale_reference(const bitmap *in, const char *path);
+static bool nearest_reference(const bitmap *in, const char *path);
+static bool bilinear_half_reference(const bitmap *in, const char *path);
+static bool bilinear_reference(const bitmap *in, const char *path);
+static bool bicubic_reference(const bitmap *in, const char *path);
+static bool lanczos_reference(const bitmap *in, const char *path);
+static bool fused_reference(const bitmap *in, const char *path);
+
+// Every operation measured. Resizes work in floats and their references in doubles,
+// so a channel rounded the other way is off by one
+static const operation OPERATIONS[] =
+{
+    {"reveal", "reveal", reveal_reference, 0},
+    {"grayscale", "grayscale", grayscale_reference, 0},
+    {"resize nearest 2", "resize=2 kernel=nearest", nearest_reference, 0},
+    {"resize bilinear 0.5", "resize=0.5", bilinear_half_reference, 1},
+    {"resize bilinear 2.5", "resize=2.5", bilinear_reference, 1},
+    {"resize bicubic 1.5", "resize=1.5 kernel=bicubic", bicubic_reference, 1},
+    {"resize lanczos 0.5", "resize=0.5 kernel=lanczos", lanczos_reference, 1},
+    {"reveal, resize 2.5, grayscale", "reveal resize=2.5 grayscale", fused_reference, 1}
+};
+#define NOPERATIONS (sizeof(OPERATIONS) / sizeof(OPERATIONS[0]))
+
+// Returns the monotonic time in seconds
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// whodunit's original filter: pure red and pure white become black
+static void reveal_pixel(BYTE *p)
+{
+    if (p[2] == 0xff && ((p[0] == 0x00 && p[1] == 0x00) || (p[0] == 0xff && p[1] == 0xff)))
+    {
+        p[0] = p[1] = p[2] = 0x00;
+    }
+}
+
+// BT.601 gray, rounded
+static void gray_pixel(BYTE *p)
+{
+    p[0] = p[1] = p[2] = (29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8;
+}
+
+// Reveals every pixel
+static bool reveal_reference(const bitmap *in, const char *path)
+{
+    bitmap out;
+    if (bmp_create(&out, path, in->width, in->height, in->top_down, in->bytes, in) != BMP_OK)
+    {
+        return false;
+    }
+    for (int i = 0; i < in->height; i++)
+    {
+        for (int j = 0; j < in->width; j++)
+        {
+            BYTE *q = bmp_pixel(&out, i, j);
+            memcpy(q, bmp_pixel(in, i, j), in->bytes);
+            reveal_pixel(q);
+        }
+    }
+    return bmp_close(&out);
+}
+
+// Grays every pixel
+static bool grayscale_reference(const bitmap *in, const char *path)
+{
+    bitmap out;
+    if (bmp_create(&out, path, in->width, in->height, in->top_down, in->bytes, in) != BMP_OK)
+    {
+        return false;
+    }
+    for (int i = 0; i < in->height; i++)
+    {
+        for (int j = 0; j < in->width; j++)
+        {
+            BYTE *q = bmp_pixel(&out, i, j);
+            memcpy(q, bmp_pixel(in, i, j), in->bytes);
+            gray_pixel(q);
+        }
+    }
+    return bmp_close(&out);
+}
+
+// resize's original: every pixel repeated twice across and down
+static bool nearest_reference(const bitmap *in, const char *path)
+{
+    bitmap out;
+    if (bmp_create(&out, path, in->width * 2, in->height * 2, in->top_down, in->bytes, in) != BMP_OK)
+    {
+        return false;
+    }
+    for (int i = 0; i < out.height; i++)
+    {
+        for (int j = 0; j < out.width; j++)
+        {
+            memcpy(bmp_pixel(&out, i, j), bmp_pixel(in, i / 2, j / 2), in->bytes);
+        }
+    }
+    return bmp_close(&out);
+}
+
+// Evaluates filter f's kernel at distance x: a tent, Catmull-Rom or Lanczos-3
+static double kernel_at(filter f, double x)
+{
+    double d = fabs(x);
+    if (f == BILINEAR)
+    {
+        return d < 1 ? 1 - d : 0;
+    }
+    if (f == BICUBIC)
+    {
+        return d < 1 ? 1.5 * d * d * d - 2.5 * d * d + 1 : d < 2 ? -0.5 * d * d * d + 2.5 * d * d - 4 * d + 2 : 0;
+    }
+    if (d == 0)
+    {
+        return 1;
+    }
+    return d < 3 ? 3 * sin(M_PI * d) * sin(M_PI * d / 3) / (M_PI * M_PI * d * d) : 0;
+}
+
+// Weighs the input pixels behind output pixel o of an axis scaled from in to out pixels by filter f:
+// those within the kernel's reach of its centre, widened by the shrink factor, normalized over the image.
+// Sets the first of them and returns how many there are
+static int reach(int o, int in, int out, filter f, double weight[], int *first)
+{
+    double scale = (double) out / in;
+    double stretch = scale < 1 ? 1 / scale : 1;
+    double radius = (f == BILINEAR ? 1 : f == BICUBIC ? 2 : 3) * stretch;
+    double centre = (o + 0.5) / scale - 0.5;
+    int lo = (int) ceil(centre - radius), hi = (int) floor(centre + radius);
+    lo = lo < 0 ? 0 : lo;
+    hi = hi > in - 1 ? in - 1 : hi;
+    double sum = 0;
+    for (int i = lo; i <= hi; i++)
+    {
+        weight[i - lo] = kernel_at(f, (i - centre) / stretch);
+        sum += weight[i - lo];
+    }
+    for (int i = lo; sum != 0 && i <= hi; i++)
+    {
+        weight[i - lo] /= sum;
+    }
+    *first = lo;
+    return hi - lo + 1;
+}
+
+// Resizes by factor with filter f in doubles, blending down the columns of each output row then across it,
+// revealing input pixels first and graying output pixels after if asked
+static bool resample_reference(const bitmap *in, const char *path, double factor, filter f, bool reveal, bool gray)
+{
+    bitmap out;
+    if (bmp_create(&out, path, scaled_size(in->width, factor), scaled_size(in->height, factor), in->top_down,
+                   in->bytes, in) != BMP_OK)
+    {
+        return false;
+    }
+    //a kernel reaches at most three input pixels either side, times however much an axis shrinks
+    double shrink = fmax(fmax((double) in->width / out.width, (double) in->height / out.height), 1);
+    int max = (int) ceil(3 * shrink) * 2 + 1;
+    double *wx = malloc(max * sizeof(double)), *wy = malloc(max * sizeof(double));
+    double *column = malloc((size_t) in->width * in->bytes * sizeof(double));
+    bool ok = wx != NULL && wy != NULL && column != NULL;
+    for (int i = 0; ok && i < out.height; i++)
+    {
+        int top, rows = reach(i, in->height, out.height, f, wy, &top);
+        memset(column, 0, (size_t) in->width * in->bytes * sizeof(double));
+        for (int r = 0; r < rows; r++)
+        {
+            for (int j = 0; j < in->width; j++)
+            {
+                BYTE p[4];
+                memcpy(p, bmp_pixel(in, top + r, j), in->bytes);
+                if (reveal)
+                {
+                    reveal_pixel(p);
+                }
+                for (int c = 0; c < in->bytes; c++)
+                {
+                    column[(size_t) j * in->bytes + c] += wy[r] * p[c];
+                }
+            }
+        }
+        for (int j = 0; j < out.width; j++)
+        {
+            int left, taps = reach(j, in->width, out.width, f, wx, &left);
+            BYTE *q = bmp_pixel(&out, i, j);
+            for (int c = 0; c < in->bytes; c++)
+            {
+                double value = 0;
+                for (int t = 0; t < taps; t++)
+                {
+                    value += wx[t] * column[(size_t)(left + t) * in->bytes + c];
+                }
+                q[c] = value <= 0 ? 0 : value >= 255 ? 255 : (BYTE) lround(value);
+            }
+            if (gray)
+            {
+                gray_pixel(q);
+            }
+        }
+    }
+    free(wx);
+    free(wy);
+    free(column);
+    return bmp_close(&out) && ok;
+}
+
+// Halves with bilinear
+static bool bilinear_half_reference(const bitmap *in, const char *path)
+{
+    return resample_reference(in, path, 0.5, BILINEAR, false, false);
+}
+
+// Scales by 2.5 with bilinear
+static bool bilinear_reference(const bitmap *in, const char *path)
+{
+    return resample_reference(in, path, 2.5, BILINEAR, false, false);
+}
+
+// Scales by 1.5 with bicubic
+static bool bicubic_reference(const bitmap *in, const char *path)
+{
+    return resample_reference(in, path, 1.5, BICUBIC, false, false);
+}
+
+// Halves with Lanczos
+static bool lanczos_reference(const bitmap *in, const char *path)
+{
+    return resample_reference(in, path, 0.5, LANCZOS, false, false);
+}
+
+// Reveals, scales by 2.5 with bilinear, then grays
+static bool fused_reference(const bitmap *in, const char *path)
+{
+    return resample_reference(in, path, 2.5, BILINEAR, true, true);
+}
+
+// Returns true if the BMPs at a and b are the same size and no channel of any pixel differs by more than tolerance
+static bool close_to(const char *a, const char *b, int tolerance)
+{
+    bitmap ba, bb;
+    bool opened_a = bmp_open(&ba, a) == BMP_OK, opened_b = bmp_open(&bb, b) == BMP_OK;
+    bool close = opened_a && opened_b && ba.width == bb.width && ba.height == bb.height && ba.bytes == bb.bytes;
+    for (int i = 0; close && i < ba.height; i++)
+    {
+        const BYTE *p = bmp_row(&ba, i), *q = bmp_row(&bb, i);
+        for (int k = 0; close && k < ba.width * ba.bytes; k++)
+        {
+            close = abs(p[k] - q[k]) <= tolerance;
+        }
+    }
+    if (opened_a)
+    {
+        bmp_close(&ba);
+    }
+    if (opened_b)
+    {
+        bmp_close(&bb);
+    }
+    return close;
+}
+
+// Returns true if the files at a and b hold the same bytes
+static bool same_file(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    bool same = fa != NULL && fb != NULL;
+    char ba[1 << 16], bb[1 << 16];
+    while (same)
+    {
+        size_t na = fread(ba, 1, sizeof(ba), fa), nb = fread(bb, 1, sizeof(bb), fb);
+        same = na == nb && memcmp(ba, bb, na) == 0;
+        if (na == 0)
+        {
+            break;
+        }
+    }
+    if (fa != NULL)
+    {
+        fclose(fa);
+    }
+    if (fb != NULL)
+    {
+        fclose(fb);
+    }
+    return same;
+}
+
+int main(int argc, char *argv[])
+{
+    //-s and -t size the test images, whose widths run from -s to -s + 3 so rows need every amount of padding,
+    //-j is the most threads tried (doubling from 1), -r how many runs each result is the best of,
+    //-o where the JSON results go (- for stdout), -d where the images are written
+    int width = 2048, height = 2048;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int repeats = 3;
+    char *results = "-";
+    char *dir = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:j:o:r:s:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                dir = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'o':
+                results = optarg;
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                break;
+            case 's':
+                width = atoi(optarg);
+                break;
+            case 't':
+                height = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+        }
+    }
+    if (argc != optind || width < 1 || height < 1 || repeats < 1)
+    {
+        fprintf(stderr, "%s", USAGE);
+        return 1;
+    }
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    //images go in a fresh directory unless one's given
+    char scratch[] = "/tmp/imgbench.XXXXXX";
+    if (dir == NULL && (dir = mkdtemp(scratch)) == NULL)
+    {
+        fprintf(stderr, "Could not create a directory for test images.\n");
+        return 3;
+    }
+    FILE *out = strcmp(results, "-") == 0 ? stdout : fopen(results, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not create %s.\n", results);
+        return 3;
+    }
+
+    char in_path[4096], out_path[4096], ref_path[4096];
+    snprintf(in_path, sizeof(in_path), "%s/in.bmp", dir);
+    snprintf(out_path, sizeof(out_path), "%s/out.bmp", dir);
+    snprintf(ref_path, sizeof(ref_path), "%s/reference.bmp", dir);
+
+    int status = 0;
+    bool first = true;
+    fprintf(out, "[");
+    for (int w = width; w < width + 4 && status == 0; w++)
+    {
+        bitmap in;
+        if (!synth_bmp(in_path, w, height, NOISE, w, false) || bmp_open(&in, in_path) != BMP_OK)
+        {
+            fprintf(stderr, "Could not create %s.\n", in_path);
+            status = 3;
+            break;
+        }
+        for (size_t i = 0; i < NOPERATIONS && status == 0; i++)
+        {
+            plan p;
+            plan_init(&p);
+            parse_operation(&p, OPERATIONS[i].operation);
+            if (OPERATIONS[i].check != NULL && !OPERATIONS[i].check(&in, ref_path))
+            {
+                fprintf(stderr, "Could not create %s.\n", ref_path);
+                status = 3;
+                break;
+            }
+
+            //each thread count's best time, checked against the reference (or the first run)
+            for (int t = 1; t <= threads && status == 0; t *= 2)
+            {
+                double best = 0;
+                bool exact = true;
+                for (int r = 0; r < repeats && status == 0; r++)
+                {
+                    double start = now();
+                    status = run_plan(&p, in_path, out_path, t);
+                    double seconds = now() - start;
+                    best = r == 0 || seconds < best ? seconds : best;
+                    if (OPERATIONS[i].check == NULL && t == 1 && r == 0)
+                    {
+                        rename(out_path, ref_path);
+                    }
+                    else
+                    {
+                        exact = exact && (OPERATIONS[i].tolerance == 0 ? same_file(out_path, ref_path) :
+                                          close_to(out_path, ref_path, OPERATIONS[i].tolerance));
+                    }
+                }
+                if (status != 0)
+                {
+                    break;
+                }
+                if (!exact)
+                {
+                    fprintf(stderr, "%s of a %ix%i image on %i threads doesn't match.\n", OPERATIONS[i].name, w, height,
+                            t);
+                    status = 6;
+                }
+
+                //throughput counts the larger of the input and output, as every pixel of it is touched
+                double pixels = (double) w * height;
+                double scaled = (double) scaled_size(w, p.fx) * scaled_size(height, p.fy);
+                fprintf(out, "%s\n  {\"operation\": \"%s\", \"width\": %i, \"height\": %i, \"padding\": %i, "
+                        "\"scale\": [%g, %g], \"threads\": %i, \"seconds\": %.6f, \"mpx_per_s\": %.3f, \"exact\": %s}",
+                        first ? "" : ",", OPERATIONS[i].name, w, height, (4 - (w * 3) % 4) % 4, p.fx, p.fy, t, best,
+                        best > 0 ? (pixels > scaled ? pixels : scaled) / 1e6 / best : 0, exact ? "true" : "false");
+                first = false;
+            }
+        }
+        bmp_close(&in);
+    }
+    fprintf(out, "\n]\n");
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+    //scratch images are removed, those in a directory that was asked for are kept
+    if (dir == scratch)
+    {
+        unlink(in_path);
+        unlink(out_path);
+        unlink(ref_path);
+        rmdir(scratch);
+    }
+    return status;
+}
@@ -0,0 +1,65 @@
+// Generates a synthetic 24-bit BMP
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "synth.h"
+
+// How to run generate
+const char *USAGE = "Usage: ./generate [-c noise|gradient|solid] [-s seed] [-t] width height outfile\n";
+
+int main(int argc, char *argv[])
+{
+    //-c picks what fills the image, -s seeds its noise, -t stores it top-down
+    content c = NOISE;
+    unsigned seed = 1;
+    bool top_down = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:s:t")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                if (parse_content(optarg, &c))
+                {
+                    break;
+                }
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                top_down = true;
+                break;
+            default:
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+        }
+    }
+
+    // ensure proper usage
+    if (argc - optind != 3)
+    {
+        fprintf(stderr, "%s", USAGE);
+        return 1;
+    }
+    int width = atoi(argv[optind]);
+    int height = atoi(argv[optind + 1]);
+    if (width < 1 || height < 1)
+    {
+        fprintf(stderr, "%s", USAGE);
+        return 1;
+    }
+
+    if (!synth_bmp(argv[optind + 2], width, height, c, seed, top_down))
+    {
+        fprintf(stderr, "Could not create %s.\n", argv[optind + 2]);
+        return 3;
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+// Filters and resizes BMP files in one pass each, with no intermediate files
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "batch.h"
+#include "plan.h"
+
+// How to run imgpipe
+const char *USAGE = "Usage: ./imgpipe [-j threads] infile outfile [stage]...\n"
+                    "       ./imgpipe [-j threads] -d indir outdir [stage]...\n"
+                    "       ./imgpipe [-j threads] -b manifest.csv [stage]...\n"
+                    "where each stage is --filter name[=value], --reveal, --grayscale, --threshold[=level],\n"
+                    "--swap=order, --tint=RRGGBB, --resize factor[xfactor] or --kernel nearest|bilinear|bicubic|lanczos\n";
+
+// Long options, each a stage of the same name
+static const struct option OPTIONS[] =
+{
+    {"filter", required_argument, NULL, 'S'},
+    {"resize", required_argument, NULL, 'S'},
+    {"kernel", required_argument, NULL, 'S'},
+    {"reveal", no_argument, NULL, 'S'},
+    {"grayscale", no_argument, NULL, 'S'},
+    {"threshold", optional_argument, NULL, 'S'},
+    {"swap", required_argument, NULL, 'S'},
+    {"tint", required_argument, NULL, 'S'},
+    {NULL, 0, NULL, 0}
+};
+
+int main(int argc, char *argv[])
+{
+    //stages run in the order given: filters before --resize work on input rows, those after on output rows.
+    //-d runs them over every .bmp in a directory, -b over a manifest of input,output[,operation] lines
+    //(those without an operation get the command line's stages), -j processes that many files
+    //at once, or renders one file's bands on that many threads
+    plan p;
+    plan_init(&p);
+    char *manifest = NULL;
+    bool directory = false;
+    int threads = 1;
+    int opt, index;
+    while ((opt = getopt_long(argc, argv, "b:dj:", OPTIONS, &index)) != -1)
+    {
+        bool ok = true;
+        switch (opt)
+        {
+            case 'S':
+                ok = add_stage(&p, OPTIONS[index].name, optarg);
+                break;
+            case 'b':
+                manifest = optarg;
+                break;
+            case 'd':
+                directory = true;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                ok = threads > 0;
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "%s", USAGE);
+            return 1;
+        }
+    }
+
+    // ensure proper usage
+    if ((manifest != NULL && (directory || argc - optind != 0)) || (manifest == NULL && argc - optind != 2))
+    {
+        fprintf(stderr, "%s", USAGE);
+        return 1;
+    }
+
+    // one file
+    if (manifest == NULL && !directory)
+    {
+        return run_plan(&p, argv[optind], argv[optind + 1], threads);
+    }
+
+    //many files, each parsed and run once on the pool
+    batch b;
+    batch_init(&b);
+    bool listed = manifest ? read_manifest(&b, manifest, &p) : list_directory(&b, argv[optind], argv[optind + 1], &p);
+    if (!listed)
+    {
+        free_batch(&b);
+        return 2;
+    }
+    int status = run_batch(&b, threads);
+    free_batch(&b);
+    return status;
+}
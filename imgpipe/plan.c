@@ -0,0 +1,157 @@
+// What imgpipe does to an image, and doing it
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bands.h"
+#include "bmpio.h"
+#include "plan.h"
+
+// Longest stage in an operation
+#define STAGE_LENGTH 64
+
+// Empties a plan
+void plan_init(plan *p)
+{
+    filter_init(&p->before);
+    filter_init(&p->after);
+    p->resized = false;
+    p->fx = 1;
+    p->fy = 1;
+    p->kernel = BILINEAR;
+}
+
+// Adds the stage named name with value to p
+bool add_stage(plan *p, const char *name, const char *value)
+{
+    pixel_filter *stages = p->resized ? &p->after : &p->before;
+    if (strcmp(name, "resize") == 0)
+    {
+        if (p->resized || value == NULL || !parse_factor(value, &p->fx, &p->fy))
+        {
+            return false;
+        }
+        p->resized = true;
+        return true;
+    }
+    if (strcmp(name, "kernel") == 0)
+    {
+        return value != NULL && parse_filter(value, &p->kernel);
+    }
+    if (strcmp(name, "filter") == 0)
+    {
+        return value != NULL && add_filter(stages, value);
+    }
+
+    //the rest name a built-in filter, the stage being its spec
+    char spec[STAGE_LENGTH];
+    if (snprintf(spec, sizeof(spec), "%s%s%s", name, value ? "=" : "", value ? value : "") >= (int) sizeof(spec))
+    {
+        return false;
+    }
+    return add_filter(stages, spec);
+}
+
+// Parses an operation of space-separated stages
+bool parse_operation(plan *p, const char *operation)
+{
+    while (*operation != '\0')
+    {
+        size_t length = strcspn(operation, " \t");
+        if (length >= STAGE_LENGTH)
+        {
+            return false;
+        }
+        if (length > 0)
+        {
+            char name[STAGE_LENGTH];
+            memcpy(name, operation, length);
+            name[length] = '\0';
+            char *value = strchr(name, '=');
+            if (value != NULL)
+            {
+                *value++ = '\0';
+            }
+            if (!add_stage(p, name, value))
+            {
+                return false;
+            }
+        }
+        operation += length + (operation[length] != '\0');
+    }
+    return true;
+}
+
+// Runs p on infile using threads, writing outfile
+int run_plan(const plan *p, const char *infile, const char *outfile, int threads)
+{
+    // map infile, ensuring it's an uncompressed 24- or 32-bit BMP
+    bitmap in;
+    bmp_status status = bmp_open(&in, infile);
+    if (status == BMP_UNSUPPORTED)
+    {
+        fprintf(stderr, "Unsupported file format %s.\n", infile);
+        return 4;
+    }
+    if (status != BMP_OK)
+    {
+        fprintf(stderr, "Could not open %s.\n", infile);
+        return 2;
+    }
+
+    bitmap out;
+    status = bmp_create(&out, outfile, scaled_size(in.width, p->fx), scaled_size(in.height, p->fy), in.top_down,
+                        in.bytes, &in);
+    if (status == BMP_UNSUPPORTED)
+    {
+        bmp_close(&in);
+        fprintf(stderr, "%s would be too large for a BMP.\n", outfile);
+        return 4;
+    }
+    if (status != BMP_OK)
+    {
+        bmp_close(&in);
+        fprintf(stderr, "Could not create %s.\n", outfile);
+        return 3;
+    }
+
+    //with a resize, each input row is filtered, scaled, blended into output rows and filtered again
+    //as the bands pass over it; without one, each row is filtered straight from infile to outfile
+    bool ok = true;
+    if (p->resized)
+    {
+        resample r =
+        {
+            .in = &in,
+            .out = &out,
+            .before = p->before.count ? &p->before : NULL,
+            .after = p->after.count ? &p->after : NULL
+        };
+        ok = make_weights(&r.x, in.width, out.width, p->kernel) &&
+             make_weights(&r.y, in.height, out.height, p->kernel) && resample_bands(&r, threads);
+        free_weights(&r.x);
+        free_weights(&r.y);
+    }
+    else
+    {
+        for (int i = 0; i < in.height; i++)
+        {
+            filter_row(&p->before, bmp_row(&in, i), bmp_row(&out, i), in.width, in.bytes);
+        }
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Not enough memory for %s.\n", infile);
+    }
+
+    bmp_close(&in);
+    if (!bmp_close(&out) && ok)
+    {
+        fprintf(stderr, "Could not write %s.\n", outfile);
+        return 3;
+    }
+    return ok ? 0 : 5;
+}
@@ -0,0 +1,40 @@
+// What imgpipe does to an image, and doing it
+
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <stdbool.h>
+
+#include "filters.h"
+#include "scale.h"
+
+// Filters run on each row before and after an optional resize by fx across and fy down with kernel
+typedef struct
+{
+    pixel_filter before;
+    pixel_filter after;
+    bool resized;
+    double fx;
+    double fy;
+    filter kernel;
+}
+plan;
+
+// Empties a plan, leaving a straight copy
+void plan_init(plan *p);
+
+// Adds the stage named name (filter, reveal, grayscale, threshold, swap, tint, resize or kernel) with value,
+// which may be NULL, to p. Filters given before a resize run on input rows, those after on output rows.
+// Returns false if the stage is unknown, its value is invalid or p already resizes
+bool add_stage(plan *p, const char *name, const char *value);
+
+// Parses an operation of space-separated stages, each name or name=value (e.g. "reveal resize=2.5 grayscale"),
+// adding them to p
+bool parse_operation(plan *p, const char *operation);
+
+// Runs p on infile using threads, writing outfile. Problems are reported against the file;
+// returns 0, or 2 if infile can't be read, 3 if outfile can't be written, 4 if infile isn't supported
+// or 5 if out of memory
+int run_plan(const plan *p, const char *infile, const char *outfile, int threads);
+
+#endif // PLAN_H
@@ -0,0 +1,75 @@
+// Synthetic BMPs for testing and benchmarking imgpipe
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bmpio.h"
+#include "synth.h"
+
+// Colour of solid images: whodunit's pure red noise
+#define SOLID_COLOR 0xff0000
+
+// Parses a content name
+bool parse_content(const char *name, content *c)
+{
+    const char *names[] = {"noise", "gradient", "solid"};
+    for (int i = 0; i < 3; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            *c = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the next of a xorshift sequence
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// Writes a synthetic BMP to path
+bool synth_bmp(const char *path, int width, int height, content c, unsigned seed, bool top_down)
+{
+    bitmap b;
+    if (bmp_create(&b, path, width, height, top_down, 3, NULL) != BMP_OK)
+    {
+        return false;
+    }
+    uint32_t state = seed ? seed : 1;
+
+    //gradients run blue across, green up and red along the diagonal; padding stays zeroed
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            BYTE *p = bmp_pixel(&b, i, j);
+            if (c == NOISE)
+            {
+                uint32_t r = next_random(&state);
+                p[0] = r;
+                p[1] = r >> 8;
+                p[2] = r >> 16;
+            }
+            else if (c == GRADIENT)
+            {
+                p[0] = width > 1 ? j * 255 / (width - 1) : 0;
+                p[1] = height > 1 ? i * 255 / (height - 1) : 0;
+                p[2] = width + height > 2 ? (i + j) * 255 / (width + height - 2) : 0;
+            }
+            else
+            {
+                p[0] = SOLID_COLOR & 0xff;
+                p[1] = (SOLID_COLOR >> 8) & 0xff;
+                p[2] = SOLID_COLOR >> 16;
+            }
+        }
+    }
+    return bmp_close(&b);
+}
@@ -0,0 +1,24 @@
+// Synthetic BMPs for testing and benchmarking imgpipe
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdbool.h>
+
+// What fills a synthetic image
+typedef enum
+{
+    NOISE,
+    GRADIENT,
+    SOLID
+}
+content;
+
+// Parses a content name (noise, gradient or solid), returns false if unknown
+bool parse_content(const char *name, content *c);
+
+// Writes a width by height 24-bit BMP filled with c to path, stored top-down or not; noise comes from seed.
+// Returns false if path can't be written
+bool synth_bmp(const char *path, int width, int height, content c, unsigned seed, bool top_down);
+
+#endif // SYNTH_H
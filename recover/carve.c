@@ -0,0 +1,411 @@
+// Carving of files out of a memory-mapped card image
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "carve.h"
+#include "stats.h"
+
+// Bytes scanned between updates of the live counters
+#define WINDOW (64 << 20)
+
+// One thread's share of a scan
+typedef struct
+{
+    image *img;
+    size_t lo;
+    size_t hi;
+    bool aligned;
+    const matcher *m;
+    starts found;
+    bool ok;
+    bool threaded;
+}
+scan_job;
+
+// Shared state of the writing threads
+typedef struct
+{
+    image *img;
+    starts *s;
+    atomic_size_t next;
+    atomic_bool ok;
+}
+write_job;
+
+// Maps the image at path into memory
+bool map_image(image *img, const char *path)
+{
+    img->fd = open(path, O_RDONLY);
+    if (img->fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(img->fd, &st) != 0)
+    {
+        close(img->fd);
+        return false;
+    }
+    img->size = st.st_size;
+    img->data = NULL;
+
+    //an empty image has nothing to map
+    if (img->size == 0)
+    {
+        return true;
+    }
+    img->data = mmap(NULL, img->size, PROT_READ, MAP_PRIVATE, img->fd, 0);
+    if (img->data == MAP_FAILED)
+    {
+        close(img->fd);
+        return false;
+    }
+    madvise(img->data, img->size, MADV_SEQUENTIAL);
+    return true;
+}
+
+// Unmaps an image and closes its file
+void unmap_image(image *img)
+{
+    if (img->data != NULL)
+    {
+        munmap(img->data, img->size);
+    }
+    close(img->fd);
+}
+
+// Returns true if block begins with a JPEG signature
+bool is_jpeg(const unsigned char *block)
+{
+    return block[0] == 0xff && block[1] == 0xd8 && block[2] == 0xff && (block[3] & 0xf0) == 0xe0;
+}
+
+// Appends a file to a list of starts, doubling its capacity as needed
+static bool push_start(starts *s, start file)
+{
+    if (s->count == s->capacity)
+    {
+        size_t capacity = s->capacity ? s->capacity * 2 : 64;
+        start *files = realloc(s->files, capacity * sizeof(start));
+        if (files == NULL)
+        {
+            return false;
+        }
+        s->files = files;
+        s->capacity = capacity;
+    }
+    s->files[s->count++] = file;
+    return true;
+}
+
+// Finds the next signature in [offset, hi), using the dedicated JPEG scanners when that's all there is to find
+static size_t next_start(scan_job *job, size_t offset, size_t hi, int *which)
+{
+    const unsigned char *data = job->img->data;
+    size_t size = job->img->size;
+    if (!job->m->jpeg_only)
+    {
+        return next_match(job->m, data, offset, hi, size, job->aligned, which);
+    }
+    *which = JPEG;
+    if (job->aligned)
+    {
+        return next_block(data, offset, hi);
+    }
+
+    //a byte scan must leave room for a whole signature
+    size_t last = (size < 4) ? 0 : (hi < size - 3 ? hi : size - 3);
+    size_t found = (offset < last) ? next_byte(data, offset, last) : last;
+    return (found == last) ? hi : found;
+}
+
+// Scans one chunk for signatures
+static void *scan_chunk(void *arg)
+{
+    scan_job *job = arg;
+    job->ok = true;
+    double scanning = now();
+    size_t offset = job->lo;
+    size_t counted = job->lo;
+    while (offset < job->hi)
+    {
+        //scan a window at a time so the scanned count stays live for progress reports
+        size_t window = (job->hi - offset > WINDOW) ? offset + WINDOW : job->hi;
+        start file = {.duplicate = -1};
+        offset = next_start(job, offset, window, &file.format);
+        atomic_fetch_add_explicit(&stats.scanned, offset - counted, memory_order_relaxed);
+        counted = offset;
+        if (offset == window)
+        {
+            continue;
+        }
+        file.offset = offset;
+        if (!push_start(&job->found, file))
+        {
+            job->ok = false;
+            break;
+        }
+        atomic_fetch_add_explicit(&stats.found, 1, memory_order_relaxed);
+        offset += job->aligned ? BLOCK : 1;
+    }
+    stage_time(SCAN, scanning);
+    return NULL;
+}
+
+// Works out where each file ends, dropping those that start inside an earlier file, and numbers the rest
+static void find_ends(image *img, starts *s)
+{
+    //an end rule may look past later starts to the end of the scan; without one, or if it finds
+    //no end there, a file runs to the next start, which therefore can't be inside it
+    size_t kept = 0;
+    size_t covered = 0;
+    size_t numbers[NFORMATS] = {0};
+    for (size_t i = 0; i < s->count; i++)
+    {
+        start file = s->files[i];
+        if (file.offset < covered)
+        {
+            continue;
+        }
+        file.end = 0;
+        if (FORMATS[file.format].end != NULL)
+        {
+            file.end = FORMATS[file.format].end(img->data, file.offset, s->end);
+        }
+        if (file.end == 0)
+        {
+            file.end = (i + 1 < s->count) ? s->files[i + 1].offset : s->end;
+        }
+        covered = file.end;
+        file.number = numbers[file.format]++;
+        s->files[kept++] = file;
+    }
+    atomic_fetch_sub(&stats.found, s->count - kept);
+    s->count = kept;
+}
+
+// Finds the start of every file of m's formats in img in one pass, scanning chunks on threads
+bool find_starts(image *img, int threads, bool aligned, const matcher *m, starts *s)
+{
+    memset(s, 0, sizeof(starts));
+
+    //aligned scans carve only whole blocks, as with fread
+    size_t unit = aligned ? BLOCK : 1;
+    size_t units = aligned ? img->size / BLOCK : img->size;
+    s->end = aligned ? img->size / BLOCK * BLOCK : img->size;
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if ((size_t) threads > units)
+    {
+        threads = units ? units : 1;
+    }
+
+    //split the blocks into one contiguous chunk per thread
+    scan_job *jobs = calloc(threads, sizeof(scan_job));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if (jobs == NULL || tids == NULL)
+    {
+        free(jobs);
+        free(tids);
+        return false;
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        jobs[t].img = img;
+        jobs[t].lo = units * t / threads * unit;
+        jobs[t].hi = units * (t + 1) / threads * unit;
+        jobs[t].aligned = aligned;
+        jobs[t].m = m;
+        jobs[t].threaded = pthread_create(&tids[t], NULL, scan_chunk, &jobs[t]) == 0;
+    }
+
+    //chunks are in image order, so concatenating them lists files as a sequential scan would.
+    //A chunk whose thread didn't start is scanned here instead, so none of the image is skipped
+    bool ok = true;
+    for (int t = 0; t < threads; t++)
+    {
+        if (jobs[t].threaded)
+        {
+            pthread_join(tids[t], NULL);
+        }
+        else
+        {
+            scan_chunk(&jobs[t]);
+        }
+        ok = ok && jobs[t].ok;
+        for (size_t i = 0; ok && i < jobs[t].found.count; i++)
+        {
+            ok = push_start(s, jobs[t].found.files[i]);
+        }
+        free_starts(&jobs[t].found);
+    }
+    free(jobs);
+    free(tids);
+    if (ok)
+    {
+        find_ends(img, s);
+    }
+    return ok;
+}
+
+// Returns true if a zero-copy call failed only because this kernel or filesystem pairing doesn't support it
+static bool unsupported(void)
+{
+    return errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP;
+}
+
+// Copies len bytes of img from offset to out, letting the kernel move the data when it can:
+// copy_file_range first, then sendfile, then a plain write from the mapping
+static bool copy_extent(image *img, size_t offset, size_t len, int out)
+{
+    //the whole extent is requested at once; loops only resume short transfers
+    loff_t in_off = offset;
+    while (len > 0)
+    {
+        ssize_t n = copy_file_range(img->fd, &in_off, out, NULL, len, 0);
+        if (n <= 0)
+        {
+            if (n < 0 && !unsupported())
+            {
+                return false;
+            }
+            break;
+        }
+        len -= n;
+    }
+
+    off_t send_off = in_off;
+    while (len > 0)
+    {
+        ssize_t n = sendfile(out, img->fd, &send_off, len);
+        if (n <= 0)
+        {
+            if (n < 0 && !unsupported())
+            {
+                return false;
+            }
+            break;
+        }
+        len -= n;
+    }
+
+    const unsigned char *p = img->data + send_off;
+    while (len > 0)
+    {
+        ssize_t n = write(out, p, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Names file i of s ###.<extension>
+void file_name(starts *s, size_t i, char name[32])
+{
+    snprintf(name, 32, "%03zu.%s", s->files[i].number, FORMATS[s->files[i].format].extension);
+}
+
+// Writes the extent of file i
+static bool write_file(image *img, starts *s, size_t i)
+{
+    size_t lo = s->files[i].offset;
+    size_t hi = s->files[i].end;
+
+    char filename[32];
+    file_name(s, i, filename);
+    int out = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        fprintf(stderr, "Could not create output file %s", filename);
+        return false;
+    }
+    double writing = now();
+    bool ok = copy_extent(img, lo, hi - lo, out);
+    ok = close(out) == 0 && ok;
+    stage_time(WRITE, writing);
+    if (ok)
+    {
+        atomic_fetch_add(&stats.written, hi - lo);
+    }
+    return ok;
+}
+
+// Writes files claimed one at a time from the shared job
+static void *write_worker(void *arg)
+{
+    write_job *job = arg;
+    size_t i;
+    while (atomic_load(&job->ok) && (i = atomic_fetch_add(&job->next, 1)) < job->s->count)
+    {
+        if (job->s->files[i].duplicate < 0 && !write_file(job->img, job->s, i))
+        {
+            atomic_store(&job->ok, false);
+        }
+    }
+    return NULL;
+}
+
+// Writes each file in s that isn't a duplicate using threads
+bool write_files(image *img, starts *s, int threads)
+{
+    write_job job = {.img = img, .s = s};
+    atomic_init(&job.next, 0);
+    atomic_init(&job.ok, true);
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if (tids == NULL)
+    {
+        return false;
+    }
+    //workers claim files one at a time, so fewer threads than asked for just write more each,
+    //and if none start this thread writes them all
+    int started = 0;
+    while (started < threads && pthread_create(&tids[started], NULL, write_worker, &job) == 0)
+    {
+        started++;
+    }
+    if (started == 0)
+    {
+        write_worker(&job);
+    }
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    return atomic_load(&job.ok);
+}
+
+// Frees a list of starts
+void free_starts(starts *s)
+{
+    free(s->files);
+    memset(s, 0, sizeof(starts));
+}
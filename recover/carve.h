@@ -0,0 +1,70 @@
+// Carving of files out of a memory-mapped card image
+
+#ifndef CARVE_H
+#define CARVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "scan.h"
+
+// Size of a block on the card
+#define BLOCK 512
+
+// A raw card image mapped into memory
+typedef struct
+{
+    int fd;
+    unsigned char *data;
+    size_t size;
+}
+image;
+
+// Where a recovered file starts and ends, its format, its number among files of that format,
+// and the index of the earlier file it duplicates (or -1)
+typedef struct
+{
+    size_t offset;
+    size_t end;
+    int format;
+    size_t number;
+    long duplicate;
+}
+start;
+
+// Recovered files in image order, and where the last one ends
+typedef struct
+{
+    start *files;
+    size_t count;
+    size_t capacity;
+    size_t end;
+}
+starts;
+
+// Maps the image at path into memory, returns false if it can't be opened or mapped
+bool map_image(image *img, const char *path);
+
+// Unmaps an image and closes its file
+void unmap_image(image *img);
+
+// Returns true if block begins with a JPEG signature
+bool is_jpeg(const unsigned char *block);
+
+// Finds the start of every file of m's formats in img in one pass, scanning chunks on threads,
+// then where each ends. Signatures inside a file already found, like the local headers of a ZIP's
+// later entries or a JPEG embedded in a PDF, don't start files of their own.
+// Unless aligned, signatures are found at any byte offset rather than only at block boundaries.
+// Returns false if out of memory
+bool find_starts(image *img, int threads, bool aligned, const matcher *m, starts *s);
+
+// Names file i of s ###.<extension>
+void file_name(starts *s, size_t i, char name[32]);
+
+// Writes each file in s that isn't a duplicate using threads, returns false if an output couldn't be written
+bool write_files(image *img, starts *s, int threads);
+
+// Frees a list of starts
+void free_starts(starts *s);
+
+#endif // CARVE_H
@@ -0,0 +1,278 @@
+// Deduplication of carved files by content hash
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dedup.h"
+#include "stats.h"
+
+// Multipliers for the fast hash
+#define MULTIPLIER1 0x9e3779b97f4a7c15ull
+#define MULTIPLIER2 0xbf58476d1ce4e5b9ull
+
+// Shared state of the hashing threads
+typedef struct
+{
+    image *img;
+    starts *s;
+    digest *digests;
+    atomic_size_t next;
+}
+hash_job;
+
+// Mixes one 8-byte word into a fast hash
+static uint64_t mix(uint64_t h, const unsigned char *word)
+{
+    uint64_t w;
+    memcpy(&w, word, sizeof(w));
+    h ^= w * MULTIPLIER2;
+    h = (h << 31 | h >> 33) * MULTIPLIER1;
+    return h;
+}
+
+// Starts a running digest
+void hasher_init(hasher *h)
+{
+    h->fast = MULTIPLIER1;
+    h->ntail = 0;
+    h->length = 0;
+    sha256_init(&h->strong);
+}
+
+// Feeds len bytes into the fast hash a word at a time, carrying leftovers between calls
+static void fast_update(hasher *h, const unsigned char *data, size_t len)
+{
+    h->length += len;
+    if (h->ntail > 0)
+    {
+        size_t n = (8 - h->ntail < len) ? 8 - h->ntail : len;
+        memcpy(h->tail + h->ntail, data, n);
+        h->ntail += n;
+        data += n;
+        len -= n;
+        if (h->ntail < 8)
+        {
+            return;
+        }
+        h->fast = mix(h->fast, h->tail);
+        h->ntail = 0;
+    }
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        h->fast = mix(h->fast, data);
+    }
+    memcpy(h->tail, data, len);
+    h->ntail = len;
+}
+
+// Finishes the fast hash, folding in the leftovers and the length
+static uint64_t fast_final(hasher *h)
+{
+    memset(h->tail + h->ntail, 0, 8 - h->ntail);
+    uint64_t f = mix(h->fast, h->tail) ^ h->length;
+    f ^= f >> 33;
+    f *= MULTIPLIER2;
+    f ^= f >> 29;
+    return f;
+}
+
+// Feeds len bytes into a running digest
+void hasher_update(hasher *h, const unsigned char *data, size_t len)
+{
+    fast_update(h, data, len);
+    sha256_update(&h->strong, data, len);
+}
+
+// Finishes a running digest, including its SHA-256
+void hasher_final(hasher *h, digest *d)
+{
+    d->length = h->length;
+    d->fast = fast_final(h);
+    sha256_final(&h->strong, d->strong);
+    d->strong_known = true;
+}
+
+// Computes the SHA-256 of mapped bytes unless it's known already, returns false if it can't be
+static bool confirm(digest *d, const unsigned char *data)
+{
+    if (!d->strong_known && data != NULL)
+    {
+        sha256 ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, data, d->length);
+        sha256_final(&ctx, d->strong);
+        d->strong_known = true;
+    }
+    return d->strong_known;
+}
+
+// Doubles a table's slots, rehashing every canonical file, returns false if out of memory
+static bool grow(dedup_table *t)
+{
+    size_t capacity = t->capacity ? t->capacity * 2 : 1024;
+    canonical *slots = calloc(capacity, sizeof(canonical));
+    if (slots == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < t->capacity; i++)
+    {
+        if (t->slots[i].name[0] != '\0')
+        {
+            size_t j = t->slots[i].d.fast & (capacity - 1);
+            while (slots[j].name[0] != '\0')
+            {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = t->slots[i];
+        }
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->capacity = capacity;
+    return true;
+}
+
+// Looks file index up by digest
+const canonical *dedup_check(dedup_table *t, digest *d, const unsigned char *data, const char *name, size_t index)
+{
+    if (2 * (t->count + 1) > t->capacity && !grow(t))
+    {
+        return NULL;
+    }
+
+    //fast hashes pick candidates; SHA-256 decides
+    size_t j = d->fast & (t->capacity - 1);
+    for (; t->slots[j].name[0] != '\0'; j = (j + 1) & (t->capacity - 1))
+    {
+        canonical *c = &t->slots[j];
+        if (c->d.fast == d->fast && c->d.length == d->length && confirm(&c->d, c->data) && confirm(d, data) &&
+            memcmp(c->d.strong, d->strong, SHA256_LENGTH) == 0)
+        {
+            return c;
+        }
+    }
+
+    canonical *c = &t->slots[j];
+    c->d = *d;
+    c->data = data;
+    c->index = index;
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    t->count++;
+    return NULL;
+}
+
+// Frees a table
+void dedup_free(dedup_table *t)
+{
+    free(t->slots);
+    memset(t, 0, sizeof(dedup_table));
+}
+
+// Fast-hashes the extents of files claimed one at a time from the shared job
+static void *hash_worker(void *arg)
+{
+    hash_job *job = arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->s->count)
+    {
+        size_t lo = job->s->files[i].offset;
+        size_t hi = job->s->files[i].end;
+        hasher h;
+        hasher_init(&h);
+        fast_update(&h, job->img->data + lo, hi - lo);
+        job->digests[i].fast = fast_final(&h);
+        job->digests[i].length = hi - lo;
+        job->digests[i].strong_known = false;
+    }
+    return NULL;
+}
+
+// Marks each file in s whose content matches an earlier file
+bool dedup_files(image *img, starts *s, int threads)
+{
+    hash_job job = {.img = img, .s = s};
+    atomic_init(&job.next, 0);
+    job.digests = calloc(s->count ? s->count : 1, sizeof(digest));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if (job.digests == NULL || tids == NULL)
+    {
+        free(job.digests);
+        free(tids);
+        return false;
+    }
+
+    //hash in parallel; workers claim files one at a time, so if no thread starts this one hashes them all
+    double scanning = now();
+    int started = 0;
+    while (started < threads && pthread_create(&tids[started], NULL, hash_worker, &job) == 0)
+    {
+        started++;
+    }
+    if (started == 0)
+    {
+        hash_worker(&job);
+    }
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+
+    //then decide in image order, so the first copy is always the canonical one
+    dedup_table table = {0};
+    bool ok = true;
+    for (size_t i = 0; ok && i < s->count; i++)
+    {
+        char name[32];
+        file_name(s, i, name);
+        size_t count = table.count;
+        const canonical *c = dedup_check(&table, &job.digests[i], img->data + s->files[i].offset, name, i);
+        if (c != NULL)
+        {
+            s->files[i].duplicate = c->index;
+        }
+        ok = c != NULL || table.count > count;
+    }
+    stage_time(SCAN, scanning);
+    dedup_free(&table);
+    free(job.digests);
+    return ok;
+}
+
+// Settles one duplicate file that has already been written
+bool settle_duplicate(const char *name, const char *canonical_name, dedup_mode mode, FILE *manifest)
+{
+    atomic_fetch_add(&stats.duplicates, 1);
+    unlink(name);
+    if (mode == LINK && link(canonical_name, name) != 0)
+    {
+        fprintf(stderr, "Could not link %s to %s.\n", name, canonical_name);
+        return false;
+    }
+    return fprintf(manifest, "%s,%s\n", name, canonical_name) > 0;
+}
+
+// Skips or links the duplicates in s, recording each in manifest
+bool finish_duplicates(starts *s, dedup_mode mode, FILE *manifest)
+{
+    for (size_t i = 0; i < s->count; i++)
+    {
+        if (s->files[i].duplicate >= 0)
+        {
+            char name[32], canonical_name[32];
+            file_name(s, i, name);
+            file_name(s, s->files[i].duplicate, canonical_name);
+            if (!settle_duplicate(name, canonical_name, mode, manifest))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+// Deduplication of carved files by content hash
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "carve.h"
+#include "sha256.h"
+
+// What to do with a file whose content was already carved
+typedef enum
+{
+    KEEP,
+    SKIP,
+    LINK
+}
+dedup_mode;
+
+// Content digests of one file: a fast hash, confirmed by SHA-256 only when fast hashes collide
+typedef struct
+{
+    uint64_t fast;
+    size_t length;
+    bool strong_known;
+    unsigned char strong[SHA256_LENGTH];
+}
+digest;
+
+// Running digest of a file that is being streamed out
+typedef struct
+{
+    uint64_t fast;
+    unsigned char tail[8];
+    size_t ntail;
+    size_t length;
+    sha256 strong;
+}
+hasher;
+
+// A canonical file: its digest, its name and index, and where its bytes are if they're mapped
+typedef struct
+{
+    digest d;
+    const unsigned char *data;
+    char name[32];
+    size_t index;
+}
+canonical;
+
+// Files carved so far, keyed by fast hash
+typedef struct
+{
+    canonical *slots;
+    size_t capacity;
+    size_t count;
+}
+dedup_table;
+
+// Starts a running digest
+void hasher_init(hasher *h);
+
+// Feeds len bytes into a running digest
+void hasher_update(hasher *h, const unsigned char *data, size_t len);
+
+// Finishes a running digest, including its SHA-256
+void hasher_final(hasher *h, digest *d);
+
+// Looks file index up by digest, returning the canonical file with the same content, or NULL after adding
+// this file as canonical (or running out of memory). data may be NULL if the digest's SHA-256 is already known
+const canonical *dedup_check(dedup_table *t, digest *d, const unsigned char *data, const char *name, size_t index);
+
+// Frees a table
+void dedup_free(dedup_table *t);
+
+// Marks each file in s whose content matches an earlier file, hashing extents on threads.
+// Returns false if out of memory
+bool dedup_files(image *img, starts *s, int threads);
+
+// Skips or links the duplicates in s, recording each in manifest. Returns false on error
+bool finish_duplicates(starts *s, dedup_mode mode, FILE *manifest);
+
+// Settles one duplicate file that has already been written: removes it and, if linking,
+// hard-links it to its canonical file. Records it in manifest. Returns false on error
+bool settle_duplicate(const char *name, const char *canonical_name, dedup_mode mode, FILE *manifest);
+
+#endif // DEDUP_H
@@ -0,0 +1,331 @@
+// Table of file formats recover can carve
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+
+#include "formats.h"
+
+// Returns the offset just past the first needle in data[from, limit), or 0 if there is none
+static size_t after_first(const unsigned char *data, size_t from, size_t limit, const char *needle, size_t n)
+{
+    if (from >= limit)
+    {
+        return 0;
+    }
+    const unsigned char *hit = memmem(data + from, limit - from, needle, n);
+    return hit ? (size_t)(hit - data) + n : 0;
+}
+
+// Reads a little-endian 16-bit integer
+static uint32_t le16(const unsigned char *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+// Reads a little-endian 32-bit integer
+static uint32_t le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// Reads a little-endian 64-bit integer
+static uint64_t le64(const unsigned char *p)
+{
+    return le32(p) | (uint64_t) le32(p + 4) << 32;
+}
+
+// Returns the offset just past a run of GIF data sub-blocks at p, or 0 if it runs past limit
+static size_t skip_blocks(const unsigned char *data, size_t p, size_t limit)
+{
+    while (p < limit)
+    {
+        size_t n = data[p];
+        p += 1 + n;
+        if (n == 0)
+        {
+            return p <= limit ? p : 0;
+        }
+    }
+    return 0;
+}
+
+// PNGs end with their IEND chunk, found by walking the chunks by their lengths
+static size_t png_end(const unsigned char *data, size_t start, size_t limit)
+{
+    size_t p = start + 8;
+    while (p + 12 <= limit)
+    {
+        size_t length = (size_t) data[p] << 24 | data[p + 1] << 16 | data[p + 2] << 8 | data[p + 3];
+        if (memcmp(data + p + 4, "IEND", 4) == 0)
+        {
+            return p + 12 + length <= limit ? p + 12 + length : 0;
+        }
+
+        //chunk types are four letters; anything else means the file's been overwritten
+        for (int i = 4; i < 8; i++)
+        {
+            if (!((data[p + i] | 0x20) >= 'a' && (data[p + i] | 0x20) <= 'z'))
+            {
+                return 0;
+            }
+        }
+        if (length > limit - p - 12)
+        {
+            return 0;
+        }
+        p += 12 + length;
+    }
+    return 0;
+}
+
+// GIFs end with the trailer byte after their last block, found by walking the blocks
+// from the screen descriptor so trailer bytes inside image data don't count
+static size_t gif_end(const unsigned char *data, size_t start, size_t limit)
+{
+    size_t p = start + 13;
+    if (p > limit)
+    {
+        return 0;
+    }
+    if (data[start + 10] & 0x80)
+    {
+        p += 3 << ((data[start + 10] & 7) + 1);
+    }
+    while (p < limit)
+    {
+        if (data[p] == 0x3b)
+        {
+            return p + 1;
+        }
+        if (data[p] == 0x21)
+        {
+            //an extension: its label, then data sub-blocks
+            p = skip_blocks(data, p + 2, limit);
+        }
+        else if (data[p] == 0x2c && p + 10 < limit)
+        {
+            //an image: its descriptor, any local color table, the LZW code size, then data sub-blocks
+            unsigned char packed = data[p + 9];
+            p += 10;
+            if (packed & 0x80)
+            {
+                p += 3 << ((packed & 7) + 1);
+            }
+            p = skip_blocks(data, p + 1, limit);
+        }
+        else
+        {
+            return 0;
+        }
+        if (p == 0)
+        {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// PDFs end at the last %%EOF marker before the next PDF header (incremental updates append more),
+// plus its line ending
+static size_t pdf_end(const unsigned char *data, size_t start, size_t limit)
+{
+    size_t next = after_first(data, start + 5, limit, "%PDF-", 5);
+    if (next != 0)
+    {
+        limit = next - 5;
+    }
+    size_t end = 0;
+    for (size_t at = start + 5; (at = after_first(data, at, limit, "%%EOF", 5)) != 0; )
+    {
+        end = at;
+    }
+    if (end == 0)
+    {
+        return 0;
+    }
+    if (end < limit && data[end] == '\r')
+    {
+        end++;
+    }
+    if (end < limit && data[end] == '\n')
+    {
+        end++;
+    }
+    return end;
+}
+
+// Returns the compressed size in the zip64 extra field of the local header at p, or UINT64_MAX if it has none
+static uint64_t zip64_size(const unsigned char *data, size_t p, size_t limit)
+{
+    size_t extra = p + 30 + le16(data + p + 26);
+    size_t end = extra + le16(data + p + 28);
+    if (end > limit)
+    {
+        return UINT64_MAX;
+    }
+    while (extra + 4 <= end)
+    {
+        size_t n = le16(data + extra + 2);
+        if (le16(data + extra) == 1)
+        {
+            //the uncompressed size comes first when the header's doesn't fit either
+            size_t at = extra + 4 + (le32(data + p + 22) == 0xffffffff ? 8 : 0);
+            return (at + 8 <= extra + 4 + n && at + 8 <= end) ? le64(data + at) : UINT64_MAX;
+        }
+        extra += 4 + n;
+    }
+    return UINT64_MAX;
+}
+
+// Returns the offset of the next ZIP local or central directory header in data[from, limit), or 0 if there is none
+static size_t next_zip_header(const unsigned char *data, size_t from, size_t limit)
+{
+    while (from + 4 <= limit)
+    {
+        const unsigned char *hit = memmem(data + from, limit - from, "PK", 2);
+        if (hit == NULL || (size_t)(hit - data) + 4 > limit)
+        {
+            return 0;
+        }
+        if ((hit[2] == 3 && hit[3] == 4) || (hit[2] == 1 && hit[3] == 2))
+        {
+            return hit - data;
+        }
+        from = hit - data + 1;
+    }
+    return 0;
+}
+
+// ZIPs end with their end-of-central-directory record and its trailing comment, found by walking
+// the headers by their sizes, so the data of every entry, later entries' local headers included, is passed over
+static size_t zip_end(const unsigned char *data, size_t start, size_t limit)
+{
+    //local headers, each followed by its name, extra field and data. An entry whose sizes follow
+    //its data runs to the next header
+    size_t p = start;
+    while (p + 30 <= limit && memcmp(data + p, "PK\x03\x04", 4) == 0)
+    {
+        size_t names = le16(data + p + 26) + le16(data + p + 28);
+        uint64_t size = le32(data + p + 18);
+        if (le16(data + p + 6) & 8)
+        {
+            p = next_zip_header(data, p + 30 + names, limit);
+            if (p == 0)
+            {
+                return 0;
+            }
+            continue;
+        }
+        if (size == 0xffffffff)
+        {
+            size = zip64_size(data, p, limit);
+        }
+        if (size > limit - p || 30 + names > limit - p - size)
+        {
+            return 0;
+        }
+        p += 30 + names + size;
+    }
+
+    //central directory headers, each followed by its name, extra field and comment
+    while (p + 46 <= limit && memcmp(data + p, "PK\x01\x02", 4) == 0)
+    {
+        p += 46 + le16(data + p + 28) + le16(data + p + 30) + le16(data + p + 32);
+    }
+
+    //an optional signature and zip64 records, then the end of the central directory
+    if (p + 6 <= limit && memcmp(data + p, "PK\x05\x05", 4) == 0)
+    {
+        p += 6 + le16(data + p + 4);
+    }
+    if (p + 12 <= limit && memcmp(data + p, "PK\x06\x06", 4) == 0)
+    {
+        uint64_t size = le64(data + p + 4);
+        if (size > limit - p - 12)
+        {
+            return 0;
+        }
+        p += 12 + size;
+    }
+    if (p + 20 <= limit && memcmp(data + p, "PK\x06\x07", 4) == 0)
+    {
+        p += 20;
+    }
+    if (p + 22 > limit || memcmp(data + p, "PK\x05\x06", 4) != 0)
+    {
+        return 0;
+    }
+    p += 22 + le16(data + p + 20);
+    return p < limit ? p : limit;
+}
+
+// WAVs give their length after the RIFF tag
+static size_t wav_end(const unsigned char *data, size_t start, size_t limit)
+{
+    size_t end = start + 8 + (size_t) le32(data + start + 4);
+    return (end > start + 12 && end <= limit) ? end : 0;
+}
+
+// Every format recover knows, JPEG first. JPEGs have no end rule, so they run until the next file as before,
+// as do files whose end rule finds no end
+const format FORMATS[NFORMATS] =
+{
+    {"jpg", (const unsigned char *) "\xff\xd8\xff\xe0", (const unsigned char *) "\xff\xff\xff\xf0", 4, NULL},
+    {"png", (const unsigned char *) "\x89PNG\r\n\x1a\n", NULL, 8, png_end},
+    {"gif", (const unsigned char *) "GIF8?a", (const unsigned char *) "\xff\xff\xff\xff\x00\xff", 6, gif_end},
+    {"pdf", (const unsigned char *) "%PDF-", NULL, 5, pdf_end},
+    {"zip", (const unsigned char *) "PK\x03\x04", NULL, 4, zip_end},
+    {"wav", (const unsigned char *) "RIFF????WAVE", (const unsigned char *) "\xff\xff\xff\xff\x00\x00\x00\x00\xff\xff\xff\xff", 12, wav_end},
+};
+
+// Returns true if the header of f begins at p
+bool match_format(const format *f, const unsigned char *p)
+{
+    if (f->mask == NULL)
+    {
+        return memcmp(p, f->header, f->length) == 0;
+    }
+    for (size_t i = 0; i < f->length; i++)
+    {
+        if ((p[i] & f->mask[i]) != (f->header[i] & f->mask[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Marks the formats named in a comma-separated list of extensions
+bool select_formats(const char *list, bool selected[NFORMATS])
+{
+    memset(selected, 0, NFORMATS * sizeof(bool));
+    if (strcmp(list, "all") == 0)
+    {
+        memset(selected, 1, NFORMATS * sizeof(bool));
+        return true;
+    }
+    while (*list != '\0')
+    {
+        size_t n = strcspn(list, ",");
+        bool known = false;
+        for (int f = 0; f < NFORMATS; f++)
+        {
+            if (strlen(FORMATS[f].extension) == n && strncmp(FORMATS[f].extension, list, n) == 0)
+            {
+                selected[f] = known = true;
+            }
+        }
+        if (!known)
+        {
+            return false;
+        }
+        list += n;
+        if (*list == ',')
+        {
+            list++;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+// Table of file formats recover can carve
+
+#ifndef FORMATS_H
+#define FORMATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Number of formats in the table
+#define NFORMATS 6
+
+// Index of JPEG in the table
+#define JPEG 0
+
+// A carvable format: a header pattern, and a rule for where a file ends. The rule may look past
+// the starts of later files, which can be embedded in this one, up to limit, and returns 0 if it
+// finds no end there
+typedef struct
+{
+    const char *extension;
+    const unsigned char *header;
+    const unsigned char *mask;
+    size_t length;
+    size_t (*end)(const unsigned char *data, size_t start, size_t limit);
+}
+format;
+
+// Every format recover knows, JPEG first
+extern const format FORMATS[NFORMATS];
+
+// Returns true if the header of f begins at p, which must have f->length readable bytes
+bool match_format(const format *f, const unsigned char *p);
+
+// Marks the formats named in a comma-separated list of extensions (or "all"), returns false on an unknown name
+bool select_formats(const char *list, bool selected[NFORMATS]);
+
+#endif // FORMATS_H
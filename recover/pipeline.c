@@ -0,0 +1,539 @@
+// Streaming read, scan and write pipeline for recovering JPEGs
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "carve.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "uring.h"
+
+// Alignment of buffers, offsets and lengths for O_DIRECT reads
+#define ALIGNMENT 4096
+
+// Bytes of a JPG held back while deduplicating, so that a duplicate is never written
+#define HOLD (4 << 20)
+
+// Where a buffer is in the pipeline
+typedef enum
+{
+    FREE,
+    READING,
+    FILLED,
+    SCANNED
+}
+stage;
+
+// One chunk of the image on its way through the pipeline
+typedef struct
+{
+    unsigned char *data;
+    size_t offset;
+    size_t len;
+    size_t seq;
+    stage state;
+    size_t *starts;
+    size_t nstarts;
+}
+buffer;
+
+// State shared by the reading, scanning and writing threads
+typedef struct
+{
+    int fd;
+    size_t size;
+    buffer *buffers;
+    int nbuffers;
+    int depth;
+    size_t chunks;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool failed;
+    bool uring;
+    dedup_mode mode;
+    FILE *manifest;
+}
+pipeline;
+
+// The JPG being written: its file once created and, while deduplicating, its running digest
+// and the bytes held back until it's known not to duplicate an earlier JPG
+typedef struct
+{
+    size_t number;
+    int fd;
+    hasher h;
+    unsigned char *held;
+    size_t nheld;
+}
+output;
+
+// Moves a buffer to a new stage and wakes whoever waits on it
+static void advance(pipeline *p, buffer *b, stage state)
+{
+    pthread_mutex_lock(&p->lock);
+    b->state = state;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Marks the pipeline failed so every stage stops
+static void fail(pipeline *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->failed = true;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Waits for the buffer holding chunk seq to reach state, returns NULL if the pipeline failed
+static buffer *await(pipeline *p, size_t seq, stage state)
+{
+    buffer *b = &p->buffers[seq % p->nbuffers];
+    pthread_mutex_lock(&p->lock);
+    while (!p->failed && !(b->state == state && b->seq == seq))
+    {
+        pthread_cond_wait(&p->changed, &p->lock);
+    }
+    bool failed = p->failed;
+    pthread_mutex_unlock(&p->lock);
+    return failed ? NULL : b;
+}
+
+// Claims the buffer chunk seq will use, waiting for it to be free if wait is set.
+// Returns NULL if the pipeline failed, or if the buffer is busy and wait isn't set
+static buffer *claim(pipeline *p, size_t seq, bool wait)
+{
+    buffer *b = &p->buffers[seq % p->nbuffers];
+    pthread_mutex_lock(&p->lock);
+    while (wait && !p->failed && b->state != FREE)
+    {
+        pthread_cond_wait(&p->changed, &p->lock);
+    }
+    bool claimed = !p->failed && b->state == FREE;
+    if (claimed)
+    {
+        b->state = READING;
+        b->seq = seq;
+        b->offset = seq * CHUNK;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return claimed ? b : NULL;
+}
+
+// Reads whatever of a chunk is still missing with pread, returns false on error
+static bool finish_read(pipeline *p, buffer *b)
+{
+    size_t want = (p->size - b->offset < CHUNK) ? p->size - b->offset : CHUNK;
+
+    //ask for whole pages, as O_DIRECT requires, and let the end of the image cut the read short
+    size_t asked = (want + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    while (b->len < want)
+    {
+        ssize_t n = pread(p->fd, b->data + b->len, asked - b->len, b->offset + b->len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        b->len += n;
+    }
+    return true;
+}
+
+// Keeps up to depth chunk reads in flight with io_uring
+static bool read_uring(pipeline *p, ring *r)
+{
+    size_t next = 0;
+    size_t done = 0;
+    int inflight = 0;
+    while (done < p->chunks)
+    {
+        //top the queue up with the next chunks in image order. A busy buffer may be waiting on a read
+        //only this thread can reap, so it's only waited for once nothing is in flight
+        while (next < p->chunks && inflight < p->depth)
+        {
+            buffer *b = claim(p, next, inflight == 0);
+            if (b == NULL && inflight == 0)
+            {
+                return false;
+            }
+            if (b == NULL)
+            {
+                break;
+            }
+            b->len = 0;
+            size_t len = (p->size - b->offset < CHUNK) ? p->size - b->offset : CHUNK;
+
+            //O_DIRECT reads must cover whole pages, and a short read at the end of the image is fine
+            len = (len + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            if (!ring_read(r, p->fd, b->data, len, b->offset, next % p->nbuffers, next))
+            {
+                advance(p, b, FREE);
+                break;
+            }
+            next++;
+            inflight++;
+        }
+        double waited = now();
+        bool submitted = ring_submit(r, 1);
+        stage_time(READ, waited);
+        if (!submitted)
+        {
+            return false;
+        }
+
+        //hand completed chunks on, finishing any short reads synchronously
+        uint64_t seq;
+        int result;
+        while (ring_reap(r, &seq, &result))
+        {
+            buffer *b = &p->buffers[seq % p->nbuffers];
+            inflight--;
+            done++;
+            if (result < 0)
+            {
+                return false;
+            }
+            b->len = result;
+            double finishing = now();
+            bool finished = finish_read(p, b);
+            stage_time(READ, finishing);
+            if (!finished)
+            {
+                return false;
+            }
+            advance(p, b, FILLED);
+        }
+    }
+    return true;
+}
+
+// Reads chunks one after another with pread when io_uring isn't available
+static bool read_pread(pipeline *p)
+{
+    for (size_t seq = 0; seq < p->chunks; seq++)
+    {
+        buffer *b = claim(p, seq, true);
+        if (b == NULL)
+        {
+            return false;
+        }
+        b->len = 0;
+        double reading = now();
+        bool finished = finish_read(p, b);
+        stage_time(READ, reading);
+        if (!finished)
+        {
+            return false;
+        }
+        advance(p, b, FILLED);
+    }
+    return true;
+}
+
+// Reading stage
+static void *reader(void *arg)
+{
+    pipeline *p = arg;
+    ring r;
+    bool ok;
+    if (ring_init(&r, p->depth))
+    {
+        struct iovec *iov = calloc(p->nbuffers, sizeof(struct iovec));
+        for (int i = 0; iov != NULL && i < p->nbuffers; i++)
+        {
+            iov[i].iov_base = p->buffers[i].data;
+            iov[i].iov_len = CHUNK;
+        }
+        if (iov != NULL)
+        {
+            ring_register(&r, iov, p->nbuffers);
+        }
+        free(iov);
+        p->uring = true;
+        ok = read_uring(p, &r);
+        ring_free(&r);
+    }
+    else
+    {
+        ok = read_pread(p);
+    }
+    if (!ok)
+    {
+        fail(p);
+    }
+    return NULL;
+}
+
+// Scanning stage: finds the blocks in each chunk that start a JPEG
+static void *scanner(void *arg)
+{
+    pipeline *p = arg;
+    for (size_t seq = 0; seq < p->chunks; seq++)
+    {
+        buffer *b = await(p, seq, FILLED);
+        if (b == NULL)
+        {
+            return NULL;
+        }
+
+        //only whole blocks are carved, as with fread
+        double scanning = now();
+        b->len = b->len / BLOCK * BLOCK;
+        b->nstarts = 0;
+        for (size_t offset = 0; (offset = next_block(b->data, offset, b->len)) < b->len; offset += BLOCK)
+        {
+            b->starts[b->nstarts++] = offset;
+        }
+        stage_time(SCAN, scanning);
+        atomic_fetch_add(&stats.scanned, b->len);
+        atomic_fetch_add(&stats.found, b->nstarts);
+        advance(p, b, SCANNED);
+    }
+    return NULL;
+}
+
+// Writes data[lo, hi) to out, returns false on error
+static bool write_all(int out, const unsigned char *data, size_t lo, size_t hi)
+{
+    while (lo < hi)
+    {
+        ssize_t n = write(out, data + lo, hi - lo);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        lo += n;
+    }
+    return true;
+}
+
+// Creates the current JPG's file and writes the bytes held back for it, returns false on error
+static bool create_output(output *o)
+{
+    char filename[32];
+    sprintf(filename, "%03zu.jpg", o->number);
+    o->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (o->fd < 0)
+    {
+        fprintf(stderr, "Could not create output JPG %s", filename);
+        return false;
+    }
+    bool ok = write_all(o->fd, o->held, 0, o->nheld);
+    if (ok)
+    {
+        atomic_fetch_add(&stats.written, o->nheld);
+    }
+    o->nheld = 0;
+    return ok;
+}
+
+// Adds data[lo, hi) to the current JPG, holding it back while deduplicating if it fits, returns false on error
+static bool add_extent(pipeline *p, output *o, const unsigned char *data, size_t lo, size_t hi)
+{
+    if (p->mode != KEEP)
+    {
+        hasher_update(&o->h, data + lo, hi - lo);
+    }
+    if (o->fd < 0 && o->held != NULL && o->nheld + (hi - lo) <= HOLD)
+    {
+        memcpy(o->held + o->nheld, data + lo, hi - lo);
+        o->nheld += hi - lo;
+        return true;
+    }
+    if ((o->fd < 0 && !create_output(o)) || !write_all(o->fd, data, lo, hi))
+    {
+        return false;
+    }
+    atomic_fetch_add(&stats.written, hi - lo);
+    return true;
+}
+
+// Finishes the current JPG, settling it if it duplicates an earlier one and otherwise writing out
+// whatever was held back of it, returns false on error
+static bool finish_file(pipeline *p, output *o, dedup_table *table)
+{
+    if (p->mode == KEEP)
+    {
+        return o->fd < 0 || close(o->fd) == 0;
+    }
+    char filename[32];
+    sprintf(filename, "%03zu.jpg", o->number);
+    digest d;
+    hasher_final(&o->h, &d);
+    size_t count = table->count;
+    const canonical *c = dedup_check(table, &d, NULL, filename, o->number);
+
+    //a duplicate held back in full is never written; one too big to hold was written through and is removed
+    bool ok = c != NULL || o->fd >= 0 || create_output(o);
+    ok = (o->fd < 0 || close(o->fd) == 0) && ok;
+    if (c != NULL)
+    {
+        return settle_duplicate(filename, c->name, p->mode, p->manifest) && ok;
+    }
+    return table->count > count && ok;
+}
+
+// Writing stage: runs on the calling thread, writing each contiguous extent of a chunk in one call
+static int writer(pipeline *p)
+{
+    output o = {.fd = -1};
+    bool carving = false;
+    size_t number = 0;
+    int status = 0;
+    dedup_table table = {0};
+
+    //without room to hold files back, each is written through and removed if it's a duplicate
+    if (p->mode != KEEP)
+    {
+        o.held = malloc(HOLD);
+    }
+    for (size_t seq = 0; seq < p->chunks && status == 0; seq++)
+    {
+        buffer *b = await(p, seq, SCANNED);
+        if (b == NULL)
+        {
+            status = 2;
+            break;
+        }
+        double writing = now();
+        size_t lo = 0;
+        for (size_t i = 0; i <= b->nstarts && status == 0; i++)
+        {
+            size_t hi = (i < b->nstarts) ? b->starts[i] : b->len;
+            if (carving && !add_extent(p, &o, b->data, lo, hi))
+            {
+                status = 3;
+            }
+
+            //a new jpg closes the previous one
+            if (i < b->nstarts && status == 0)
+            {
+                if (carving && !finish_file(p, &o, &table))
+                {
+                    status = 3;
+                }
+                carving = true;
+                o.number = number++;
+                o.fd = -1;
+                o.nheld = 0;
+                hasher_init(&o.h);
+            }
+            lo = hi;
+        }
+        stage_time(WRITE, writing);
+        advance(p, b, FREE);
+    }
+    if (carving && !finish_file(p, &o, &table) && status == 0)
+    {
+        status = 3;
+    }
+    free(o.held);
+    dedup_free(&table);
+    if (status != 0)
+    {
+        fail(p);
+    }
+    return status;
+}
+
+// Recovers JPEGs from the image at path through a read, scan and write pipeline
+int recover_pipeline(const char *path, int depth, dedup_mode mode, FILE *manifest, bool *uring)
+{
+    //bypass the page cache where the filesystem allows it
+    pipeline p = {.depth = depth, .nbuffers = depth + 2, .mode = mode, .manifest = manifest};
+    p.fd = open(path, O_RDONLY | O_DIRECT);
+    if (p.fd < 0)
+    {
+        p.fd = open(path, O_RDONLY);
+    }
+    struct stat st;
+    if (p.fd < 0 || fstat(p.fd, &st) != 0)
+    {
+        fprintf(stderr, "Could not open file %s.\n", path);
+        return 2;
+    }
+    p.size = st.st_size;
+    p.chunks = (p.size + CHUNK - 1) / CHUNK;
+
+    //reads in flight, plus one chunk being scanned and one being written
+    p.buffers = calloc(p.nbuffers, sizeof(buffer));
+    bool ok = p.buffers != NULL;
+    for (int i = 0; ok && i < p.nbuffers; i++)
+    {
+        p.buffers[i].state = FREE;
+        p.buffers[i].starts = malloc(CHUNK / BLOCK * sizeof(size_t));
+        ok = p.buffers[i].starts != NULL && posix_memalign((void **) &p.buffers[i].data, ALIGNMENT, CHUNK) == 0;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        for (int i = 0; p.buffers != NULL && i < p.nbuffers; i++)
+        {
+            free(p.buffers[i].starts);
+            free(p.buffers[i].data);
+        }
+        free(p.buffers);
+        close(p.fd);
+        return 4;
+    }
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.changed, NULL);
+
+    //every stage needs the others running, so if one can't start the pipeline is failed and the rest stop
+    pthread_t reading, scanning;
+    bool read_started = pthread_create(&reading, NULL, reader, &p) == 0;
+    bool scan_started = read_started && pthread_create(&scanning, NULL, scanner, &p) == 0;
+    int status;
+    if (scan_started)
+    {
+        status = writer(&p);
+    }
+    else
+    {
+        fail(&p);
+        fprintf(stderr, "Could not start the pipeline's threads.\n");
+        status = 4;
+    }
+    if (read_started)
+    {
+        pthread_join(reading, NULL);
+    }
+    if (scan_started)
+    {
+        pthread_join(scanning, NULL);
+    }
+    if (status == 0 && p.failed)
+    {
+        fprintf(stderr, "Could not read file %s.\n", path);
+        status = 2;
+    }
+
+    *uring = p.uring;
+
+    for (int i = 0; i < p.nbuffers; i++)
+    {
+        free(p.buffers[i].starts);
+        free(p.buffers[i].data);
+    }
+    free(p.buffers);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.changed);
+    close(p.fd);
+    return status;
+}
@@ -0,0 +1,20 @@
+// Streaming read, scan and write pipeline for recovering JPEGs
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dedup.h"
+
+// Size of each read the pipeline keeps in flight
+#define CHUNK (1 << 20)
+
+// Recovers JPEGs from the image at path, keeping depth reads in flight with io_uring (or pread threads
+// when it isn't available) while earlier chunks are scanned and written. Duplicates are hashed as they stream
+// and settled per mode once written, recorded in manifest. Sets uring if io_uring was used.
+// Returns recover's exit code
+int recover_pipeline(const char *path, int depth, dedup_mode mode, FILE *manifest, bool *uring);
+
+#endif // PIPELINE_H
@@ -1,18 +1,186 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "carve.h"
+#include "dedup.h"
+#include "pipeline.h"
+#include "stats.h"
+
+// Bytes the sequential mode reads, scans and writes at a time, updating the live counters after each batch
+#define PUBLISH (1 << 20)
+
+// How to run recover
+const char *USAGE = "Usage: ./recover [-d skip|link] [-j threads] [-m manifest.csv] [-p] [-q depth] [-r] [-s summary.json] "
+                    "[-t formats] [-u] <image>\n";
+
+// Recovers JPEGs by reading the image a batch of blocks at a time
+int recover_sequential(char *raw_file);
+
+// Recovers files of m's formats from a memory-mapped image using threads,
+// skipping or linking duplicates per dedup and recording them in manifest
+int recover_parallel(char *raw_file, int threads, bool aligned, const matcher *m, dedup_mode dedup, FILE *manifest);
 
 int main(int argc, char *argv[])
 {
+    //-j carves with threads over a memory-mapped image, -u finds files that aren't block-aligned,
+    //-t carves a comma-separated list of formats rather than just jpgs,
+    //-q streams the image through a pipeline with depth reads in flight, -r reports throughput,
+    //-p shows progress while carving, -s writes a JSON summary to a file (or - for stdout),
+    //-d skips or hard-links files whose content was already recovered, listing them in the -m manifest
+    dedup_mode dedup = KEEP;
+    char *manifest_file = "duplicates.csv";
+    int threads = 0;
+    int depth = 0;
+    bool report = false;
+    bool progress = false;
+    char *summary = NULL;
+    bool aligned = true;
+    bool selected[NFORMATS] = {[JPEG] = true};
+    bool only_jpeg = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:j:m:pq:rs:t:u")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                if (!select_formats(optarg, selected))
+                {
+                    fprintf(stderr, "Unknown format in %s.\n", optarg);
+                    return 1;
+                }
+                only_jpeg = false;
+                break;
+            case 'u':
+                aligned = false;
+                break;
+            case 'r':
+                report = true;
+                break;
+            case 'p':
+                progress = true;
+                break;
+            case 's':
+                summary = optarg;
+                break;
+            case 'm':
+                manifest_file = optarg;
+                break;
+            case 'd':
+                if (strcmp(optarg, "skip") == 0 || strcmp(optarg, "link") == 0)
+                {
+                    dedup = (optarg[0] == 's') ? SKIP : LINK;
+                    break;
+                }
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+            case 'q':
+                depth = atoi(optarg);
+                if (depth > 0)
+                {
+                    break;
+                }
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+            case 'j':
+                threads = atoi(optarg);
+                if (threads > 0)
+                {
+                    break;
+                }
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+            default:
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+        }
+    }
 
     //error checking on CLAs
-    if (argc != 2)
+    if (argc - optind != 1)
     {
-        fprintf(stderr, "Usage: ./recover <image>\n");
+        fprintf(stderr, "%s", USAGE);
         return 1;
     }
 
+    //the pipeline streams block-aligned jpgs only
+    if (depth > 0 && (threads > 0 || !aligned || !only_jpeg))
+    {
+        fprintf(stderr, "-q can't be combined with -j, -t or -u.\n");
+        return 1;
+    }
+
+    //duplicates are recorded as they're found
+    FILE *manifest = NULL;
+    if (dedup != KEEP)
+    {
+        manifest = fopen(manifest_file, "w");
+        if (manifest == NULL)
+        {
+            fprintf(stderr, "Could not create manifest %s.\n", manifest_file);
+            return 3;
+        }
+        fprintf(manifest, "duplicate,canonical\n");
+    }
+
+    //carve with whichever mode was asked for, counting as it goes, and timing stages for the progress line and summary
+    char *raw_file = argv[optind];
+    struct stat st;
+    stats_start(progress, stat(raw_file, &st) == 0 ? st.st_size : 0, progress || summary != NULL);
+    int status;
+    const char *mode = "fread";
+    if (depth > 0)
+    {
+        bool uring;
+        status = recover_pipeline(raw_file, depth, dedup, manifest, &uring);
+        mode = uring ? "io_uring" : "pread";
+    }
+    else if (threads > 0 || !aligned || !only_jpeg || dedup != KEEP)
+    {
+        matcher m;
+        build_matcher(&m, selected);
+        status = recover_parallel(raw_file, threads ? threads : 1, aligned, &m, dedup, manifest);
+        mode = "mmap";
+    }
+    else
+    {
+        status = recover_sequential(raw_file);
+    }
+    stats_stop();
+    if (manifest != NULL && fclose(manifest) != 0 && status == 0)
+    {
+        status = 3;
+    }
+
+    if (report && status == 0)
+    {
+        stats_report(stderr, mode);
+    }
+    if (summary != NULL)
+    {
+        FILE *out = (strcmp(summary, "-") == 0) ? stdout : fopen(summary, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "Could not create summary %s.\n", summary);
+            return status ? status : 3;
+        }
+        stats_json(out, mode, status);
+        if (out != stdout)
+        {
+            fclose(out);
+        }
+    }
+    return status;
+}
+
+// Recovers JPEGs by reading the image a batch of blocks at a time
+int recover_sequential(char *raw_file)
+{
     //error checking on file opening
-    char *raw_file = argv[1];
     FILE *file_ptr = fopen(raw_file, "r");
     if (file_ptr == NULL)
     {
@@ -20,23 +188,69 @@ int main(int argc, char *argv[])
         return 2;
     }
 
-    unsigned char *buffer = malloc(512);
+    //blocks are read a batch at a time, so each stage's clock is read once per batch rather than per block
+    unsigned char *buffer = malloc(PUBLISH);
+    if (buffer == NULL)
+    {
+        fclose(file_ptr);
+        fprintf(stderr, "Out of memory.\n");
+        return 4;
+    }
     int jpg_number = 0;
-    FILE *img;
-
-    while (fread(buffer, 512, 1, file_ptr))
+    FILE *img = NULL;
+    size_t begins[PUBLISH / BLOCK];
+    size_t blocks;
+    while (true)
     {
-        //if new jpg file found
-        if (buffer[0] == 0xff && buffer[1] == 0xd8 && buffer[2] == 0xff && (buffer[3] & 0xf0) == 0xe0)
+        double reading = stage_clock();
+        blocks = fread(buffer, BLOCK, PUBLISH / BLOCK, file_ptr);
+        stage_time(READ, reading);
+        if (blocks == 0)
+        {
+            break;
+        }
+        atomic_fetch_add(&stats.scanned, blocks * BLOCK);
+
+        //find the blocks that start a new jpg file
+        double scanning = stage_clock();
+        size_t nstarts = 0;
+        for (size_t i = 0; i < blocks; i++)
         {
+            if (is_jpeg(buffer + i * BLOCK))
+            {
+                begins[nstarts++] = i;
+            }
+        }
+        stage_time(SCAN, scanning);
+        atomic_fetch_add(&stats.found, nstarts);
+
+        //write the blocks before each start into the current file (skipping them before the first jpg),
+        //then open the next
+        double writing = stage_clock();
+        size_t lo = 0;
+        size_t written = 0;
+        for (size_t k = 0; k <= nstarts; k++)
+        {
+            size_t hi = (k < nstarts) ? begins[k] : blocks;
+            if (img != NULL && hi > lo)
+            {
+                fwrite(buffer + lo * BLOCK, BLOCK, hi - lo, img);
+                written += (hi - lo) * BLOCK;
+            }
+            lo = hi;
+            if (k == nstarts)
+            {
+                break;
+            }
+
             //close previous jpg file
-            if (jpg_number > 0)
+            if (img != NULL)
             {
                 fclose(img);
             }
 
             //create filename
-            char filename[7];
+            char filename[16];
             sprintf(filename, "%03i.jpg", jpg_number);
 
             //open new image file
@@ -53,21 +267,56 @@ int main(int argc, char *argv[])
 
             jpg_number++;
         }
-
-        //if first jpg is not yet found, skip
-        if (!jpg_number)
-        {
-            continue;
-        }
-
-        //write jpg info into current file
-        fwrite(buffer, 512, 1, img);
+        stage_time(WRITE, writing);
+        atomic_fetch_add(&stats.written, written);
     }
 
     fclose(file_ptr);
-    fclose(img);
+    if (img != NULL)
+    {
+        fclose(img);
+    }
 
     free(buffer);
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Recovers files of m's formats from a memory-mapped image using threads, skipping or linking duplicates
+int recover_parallel(char *raw_file, int threads, bool aligned, const matcher *m, dedup_mode dedup, FILE *manifest)
+{
+    //error checking on mapping the image
+    image img;
+    if (!map_image(&img, raw_file))
+    {
+        fprintf(stderr, "Could not open file %s.\n", raw_file);
+        return 2;
+    }
+
+    //find where every file starts in one pass, then write them all out
+    starts s;
+    if (!find_starts(&img, threads, aligned, m, &s))
+    {
+        unmap_image(&img);
+        fprintf(stderr, "Out of memory.\n");
+        return 4;
+    }
+
+    //duplicates are found before writing so skipped ones cost no output I/O
+    if (dedup != KEEP && !dedup_files(&img, &s, threads))
+    {
+        free_starts(&s);
+        unmap_image(&img);
+        fprintf(stderr, "Out of memory.\n");
+        return 4;
+    }
+    bool ok = write_files(&img, &s, threads);
+    if (ok && dedup != KEEP)
+    {
+        ok = finish_duplicates(&s, dedup, manifest);
+    }
+
+    free_starts(&s);
+    unmap_image(&img);
+    return ok ? 0 : 3;
+}
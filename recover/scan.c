@@ -0,0 +1,214 @@
+// Vectorized scanning for file signatures
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+#include "carve.h"
+#include "scan.h"
+
+// A signature's first four bytes read as a little-endian word, and the bits that must match
+#define SIGNATURE 0xe0ffd8ffu
+#define SIGNATURE_MASK 0xf0ffffffu
+
+// Blocks checked per gather
+#define LANES 8
+
+// Returns true if the four bytes at p begin a JPEG
+static inline int matches(const unsigned char *p)
+{
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return (word & SIGNATURE_MASK) == SIGNATURE;
+}
+
+// Checks one block header at a time
+static size_t next_block_scalar(const unsigned char *data, size_t pos, size_t end)
+{
+    for (; pos < end; pos += BLOCK)
+    {
+        if (matches(data + pos))
+        {
+            return pos;
+        }
+    }
+    return end;
+}
+
+#ifdef SCAN_X86
+// Gathers the headers of eight blocks at once and compares them in one instruction
+__attribute__((target("avx2")))
+static size_t next_block_avx2(const unsigned char *data, size_t pos, size_t end)
+{
+    const __m256i stride = _mm256_setr_epi32(0, BLOCK, 2 * BLOCK, 3 * BLOCK, 4 * BLOCK, 5 * BLOCK, 6 * BLOCK, 7 * BLOCK);
+    const __m256i mask = _mm256_set1_epi32((int) SIGNATURE_MASK);
+    const __m256i signature = _mm256_set1_epi32((int) SIGNATURE);
+    for (; pos + LANES * BLOCK <= end; pos += LANES * BLOCK)
+    {
+        __m256i words = _mm256_i32gather_epi32((const int *)(data + pos), stride, 1);
+        __m256i hits = _mm256_cmpeq_epi32(_mm256_and_si256(words, mask), signature);
+        int bits = _mm256_movemask_ps(_mm256_castsi256_ps(hits));
+        if (bits != 0)
+        {
+            return pos + __builtin_ctz(bits) * BLOCK;
+        }
+    }
+    return next_block_scalar(data, pos, end);
+}
+
+// Compares sixteen candidate offsets at once: bytes 0 and 2 must be 0xff, byte 1 0xd8, byte 3 0xe?
+static size_t next_byte_sse2(const unsigned char *data, size_t pos, size_t end)
+{
+    const __m128i ff = _mm_set1_epi8((char) 0xff);
+    const __m128i d8 = _mm_set1_epi8((char) 0xd8);
+    const __m128i f0 = _mm_set1_epi8((char) 0xf0);
+    const __m128i e0 = _mm_set1_epi8((char) 0xe0);
+    for (; pos + 16 <= end; pos += 16)
+    {
+        const unsigned char *p = data + pos;
+        __m128i b0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), ff);
+        __m128i b1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), d8);
+        __m128i b2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), ff);
+        __m128i b3 = _mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i *)(p + 3)), f0), e0);
+        int bits = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), _mm_and_si128(b2, b3)));
+        if (bits != 0)
+        {
+            return pos + __builtin_ctz(bits);
+        }
+    }
+    for (; pos < end; pos++)
+    {
+        if (matches(data + pos))
+        {
+            return pos;
+        }
+    }
+    return end;
+}
+#endif
+
+// Returns the offset of the first block in data[pos, end) that begins with a JPEG signature
+size_t next_block(const unsigned char *data, size_t pos, size_t end)
+{
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return next_block_avx2(data, pos, end);
+    }
+#endif
+    return next_block_scalar(data, pos, end);
+}
+
+// Returns the first byte offset in [pos, end) at which a JPEG signature begins
+size_t next_byte(const unsigned char *data, size_t pos, size_t end)
+{
+#ifdef SCAN_X86
+    return next_byte_sse2(data, pos, end);
+#else
+    for (; pos < end; pos++)
+    {
+        if (matches(data + pos))
+        {
+            return pos;
+        }
+    }
+    return end;
+#endif
+}
+
+// Compiles the selected formats into a matcher
+void build_matcher(matcher *m, const bool selected[NFORMATS])
+{
+    memset(m, 0, sizeof(matcher));
+    m->jpeg_only = true;
+    for (int f = 0; f < NFORMATS; f++)
+    {
+        if (!selected[f])
+        {
+            continue;
+        }
+        if (f != JPEG)
+        {
+            m->jpeg_only = false;
+        }
+
+        //every header's first byte is unmasked, so it alone picks the candidate formats
+        unsigned char first = FORMATS[f].header[0];
+        if (m->candidates[first] == 0)
+        {
+            m->firsts[m->nfirsts++] = first;
+        }
+        m->candidates[first] |= 1 << f;
+    }
+}
+
+// Returns the format whose header begins at offset, or -1 if none does
+static int verify(const matcher *m, const unsigned char *data, size_t offset, size_t size)
+{
+    for (uint8_t bits = m->candidates[data[offset]]; bits != 0; bits &= bits - 1)
+    {
+        int f = __builtin_ctz(bits);
+        if (offset + FORMATS[f].length <= size && match_format(&FORMATS[f], data + offset))
+        {
+            return f;
+        }
+    }
+    return -1;
+}
+
+#ifdef SCAN_X86
+// Marks the offsets among the sixteen at p whose byte could start one of m's formats
+static int prefilter(const matcher *m, const unsigned char *p)
+{
+    __m128i bytes = _mm_loadu_si128((const __m128i *) p);
+    __m128i hits = _mm_setzero_si128();
+    for (int i = 0; i < m->nfirsts; i++)
+    {
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) m->firsts[i])));
+    }
+    return _mm_movemask_epi8(hits);
+}
+#endif
+
+// Returns the first offset in [pos, end) at which any of m's formats begins
+size_t next_match(const matcher *m, const unsigned char *data, size_t pos, size_t end, size_t size, bool aligned, int *which)
+{
+    if (aligned)
+    {
+        for (; pos < end; pos += BLOCK)
+        {
+            if (m->candidates[data[pos]] && (*which = verify(m, data, pos, size)) >= 0)
+            {
+                return pos;
+            }
+        }
+        return end;
+    }
+
+#ifdef SCAN_X86
+    //only offsets whose first byte passes the prefilter are verified
+    for (; pos + 16 <= end; pos += 16)
+    {
+        for (int bits = prefilter(m, data + pos); bits != 0; bits &= bits - 1)
+        {
+            size_t offset = pos + __builtin_ctz(bits);
+            if ((*which = verify(m, data, offset, size)) >= 0)
+            {
+                return offset;
+            }
+        }
+    }
+#endif
+    for (; pos < end; pos++)
+    {
+        if (m->candidates[data[pos]] && (*which = verify(m, data, pos, size)) >= 0)
+        {
+            return pos;
+        }
+    }
+    return end;
+}
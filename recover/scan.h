@@ -0,0 +1,37 @@
+// Vectorized scanning for file signatures
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "formats.h"
+
+// Selected formats compiled for a single pass: which formats each first byte may start
+typedef struct
+{
+    uint8_t candidates[256];
+    unsigned char firsts[NFORMATS];
+    int nfirsts;
+    bool jpeg_only;
+}
+matcher;
+
+// Returns the offset of the first block in data[pos, end) that begins with a JPEG signature, or end if none.
+// pos and end must be multiples of BLOCK
+size_t next_block(const unsigned char *data, size_t pos, size_t end);
+
+// Returns the first byte offset in [pos, end) at which a JPEG signature begins, or end if none.
+// data must be readable up to end + 3
+size_t next_byte(const unsigned char *data, size_t pos, size_t end);
+
+// Compiles the selected formats into a matcher
+void build_matcher(matcher *m, const bool selected[NFORMATS]);
+
+// Returns the first offset in [pos, end) at which any of m's formats begins, setting *which to the format,
+// or end if none. Only block boundaries are checked if aligned. Headers are verified against data[0, size)
+size_t next_match(const matcher *m, const unsigned char *data, size_t pos, size_t end, size_t size, bool aligned, int *which);
+
+#endif // SCAN_H
@@ -0,0 +1,31 @@
+// SHA-256, for confirming duplicate files
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Length of a digest in bytes
+#define SHA256_LENGTH 32
+
+// State of a running SHA-256
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+}
+sha256;
+
+// Starts a new digest
+void sha256_init(sha256 *ctx);
+
+// Feeds len bytes of data into the digest
+void sha256_update(sha256 *ctx, const unsigned char *data, size_t len);
+
+// Finishes the digest into out
+void sha256_final(sha256 *ctx, unsigned char out[SHA256_LENGTH]);
+
+#endif // SHA256_H
@@ -0,0 +1,136 @@
+// Live throughput counters for recover
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <time.h>
+
+#include "stats.h"
+
+// Names of the stages in JSON
+static const char *STAGE_NAMES[STAGES] = {"read", "scan", "write"};
+
+// The running carve's counters
+counters stats;
+
+// Clock and progress thread state
+static double started;
+static double stopped;
+static size_t total;
+static bool progressing;
+static bool timing;
+static bool done;
+static pthread_t progress_thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+// Returns the monotonic time in seconds
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the monotonic time in seconds if stage times are being taken, or 0
+double stage_clock(void)
+{
+    return timing ? now() : 0;
+}
+
+// Adds the time since since to a stage, if stage times are being taken
+void stage_time(int stage, double since)
+{
+    if (!timing)
+    {
+        return;
+    }
+    atomic_fetch_add_explicit(&stats.nanoseconds[stage], (unsigned long long)((now() - since) * 1e9), memory_order_relaxed);
+}
+
+// Returns seconds elapsed so far, or in total once stopped
+static double elapsed(void)
+{
+    return (stopped > 0 ? stopped : now()) - started;
+}
+
+// Prints the progress line, with the time spent in each stage so far, summed over threads
+static void print_progress(void)
+{
+    double seconds = elapsed();
+    double mb = atomic_load(&stats.scanned) / 1e6;
+    fprintf(stderr, "\r%.1f / %.1f MB (%.1f%%), %.1f MB/s, %llu files, read %.1f s, scan %.1f s, write %.1f s",
+            mb, total / 1e6, total ? 100.0 * mb * 1e6 / total : 100.0,
+            seconds > 0 ? mb / seconds : 0, (unsigned long long) atomic_load(&stats.found),
+            atomic_load(&stats.nanoseconds[READ]) / 1e9, atomic_load(&stats.nanoseconds[SCAN]) / 1e9,
+            atomic_load(&stats.nanoseconds[WRITE]) / 1e9);
+}
+
+// Refreshes the progress line every second until stopped
+static void *progress(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&lock);
+    while (!done)
+    {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec++;
+        pthread_cond_timedwait(&wake, &lock, &until);
+        print_progress();
+    }
+    pthread_mutex_unlock(&lock);
+    fprintf(stderr, "\n");
+    return NULL;
+}
+
+// Starts the clock and, if progress_line, a progress line on stderr. Stage times are only taken if timed
+void stats_start(bool progress_line, size_t total_bytes, bool timed)
+{
+    timing = timed;
+    started = now();
+    stopped = 0;
+    total = total_bytes;
+    done = false;
+    progressing = progress_line && pthread_create(&progress_thread, NULL, progress, NULL) == 0;
+}
+
+// Stops the clock and the progress line
+void stats_stop(void)
+{
+    stopped = now();
+    if (progressing)
+    {
+        pthread_mutex_lock(&lock);
+        done = true;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+        pthread_join(progress_thread, NULL);
+        progressing = false;
+    }
+}
+
+// Prints a one-line summary for people
+void stats_report(FILE *out, const char *mode)
+{
+    double seconds = elapsed();
+    double mb = atomic_load(&stats.scanned) / 1e6;
+    fprintf(out, "Scanned %.1f MB in %.3f s (%.1f MB/s) with %s\n", mb, seconds, seconds > 0 ? mb / seconds : 0, mode);
+}
+
+// Prints a JSON summary for machines
+void stats_json(FILE *out, const char *mode, int status)
+{
+    double seconds = elapsed();
+    unsigned long long scanned = atomic_load(&stats.scanned);
+    fprintf(out, "{\"mode\": \"%s\", \"status\": %i, \"seconds\": %.6f, \"bytes_scanned\": %llu, \"mb_per_s\": %.3f, "
+            "\"files_found\": %llu, \"duplicates\": %llu, \"bytes_written\": %llu, \"stage_seconds\": {",
+            mode, status, seconds, scanned, seconds > 0 ? scanned / 1e6 / seconds : 0,
+            (unsigned long long) atomic_load(&stats.found), (unsigned long long) atomic_load(&stats.duplicates),
+            (unsigned long long) atomic_load(&stats.written));
+    for (int i = 0; i < STAGES; i++)
+    {
+        fprintf(out, "%s\"%s\": %.6f", i ? ", " : "", STAGE_NAMES[i], atomic_load(&stats.nanoseconds[i]) / 1e9);
+    }
+    fprintf(out, "}}\n");
+}
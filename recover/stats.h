@@ -0,0 +1,56 @@
+// Live throughput counters for recover
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Stages whose time is measured, summed over every thread working in them
+enum
+{
+    READ,
+    SCAN,
+    WRITE,
+    STAGES
+};
+
+// Counters updated by every mode as it runs
+typedef struct
+{
+    atomic_ullong scanned;
+    atomic_ullong found;
+    atomic_ullong written;
+    atomic_ullong duplicates;
+    atomic_ullong nanoseconds[STAGES];
+}
+counters;
+
+// The running carve's counters
+extern counters stats;
+
+// Returns the monotonic time in seconds
+double now(void);
+
+// Returns the monotonic time in seconds if stage times are being taken, or 0 without reading the clock
+double stage_clock(void);
+
+// Adds the time since since to a stage, if stage times are being taken
+void stage_time(int stage, double since);
+
+// Starts the clock and, if progress_line, a line on stderr refreshed every second out of total_bytes.
+// Stage times are only taken if timed, as they're only shown on the progress line and in the summary
+void stats_start(bool progress_line, size_t total_bytes, bool timed);
+
+// Stops the clock and the progress line
+void stats_stop(void);
+
+// Prints a one-line summary for people
+void stats_report(FILE *out, const char *mode);
+
+// Prints a JSON summary for machines
+void stats_json(FILE *out, const char *mode, int status);
+
+#endif // STATS_H
@@ -0,0 +1,133 @@
+// Minimal io_uring wrapper for queued reads
+
+#define _GNU_SOURCE
+
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+// Sets up a ring with room for entries requests
+bool ring_init(ring *r, unsigned entries)
+{
+    memset(r, 0, sizeof(ring));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+    {
+        return false;
+    }
+    r->entries = p.sq_entries;
+
+    //map the submission ring, the completion ring and the submission entries
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED)
+    {
+        ring_free(r);
+        return false;
+    }
+
+    unsigned char *sq = r->sq_ring;
+    unsigned char *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+// Registers buffers with the kernel so reads can use them without mapping them each time
+bool ring_register(ring *r, struct iovec *buffers, unsigned n)
+{
+    r->fixed = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, buffers, n) == 0;
+    return r->fixed;
+}
+
+// Queues a read of len bytes at offset into buffer number index
+bool ring_read(ring *r, int fd, void *buffer, unsigned len, off_t offset, int index, uint64_t tag)
+{
+    unsigned tail = *r->sq_tail;
+    if (tail - atomic_load_explicit((_Atomic unsigned *) r->sq_head, memory_order_acquire) == r->entries)
+    {
+        return false;
+    }
+    unsigned slot = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = r->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t) buffer;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = index;
+    sqe->user_data = tag;
+    r->sq_array[slot] = slot;
+    atomic_store_explicit((_Atomic unsigned *) r->sq_tail, tail + 1, memory_order_release);
+    r->queued++;
+    return true;
+}
+
+// Submits queued reads and waits for at least wait completions
+bool ring_submit(ring *r, unsigned wait)
+{
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait, flags, NULL, 0);
+    if (n < 0)
+    {
+        return false;
+    }
+    r->queued -= n;
+    return true;
+}
+
+// Pops a completion if there is one
+bool ring_reap(ring *r, uint64_t *tag, int *result)
+{
+    unsigned head = *r->cq_head;
+    if (head == atomic_load_explicit((_Atomic unsigned *) r->cq_tail, memory_order_acquire))
+    {
+        return false;
+    }
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    *tag = cqe->user_data;
+    *result = cqe->res;
+    atomic_store_explicit((_Atomic unsigned *) r->cq_head, head + 1, memory_order_release);
+    return true;
+}
+
+// Tears a ring down
+void ring_free(ring *r)
+{
+    if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+    {
+        munmap(r->sq_ring, r->sq_ring_size);
+    }
+    if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED)
+    {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    if (r->sqes != NULL && r->sqes != MAP_FAILED)
+    {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if (r->fd >= 0)
+    {
+        close(r->fd);
+    }
+    memset(r, 0, sizeof(ring));
+    r->fd = -1;
+}
@@ -0,0 +1,54 @@
+// Minimal io_uring wrapper for queued reads
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// An io_uring instance and its mapped submission and completion rings
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    bool fixed;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned queued;
+}
+ring;
+
+// Sets up a ring with room for entries requests, returns false if io_uring isn't available
+bool ring_init(ring *r, unsigned entries);
+
+// Registers buffers with the kernel so reads can use them without mapping them each time,
+// returns false (leaving reads unregistered) if the kernel refuses
+bool ring_register(ring *r, struct iovec *buffers, unsigned n);
+
+// Queues a read of len bytes at offset into buffer number index, tagging its completion with tag
+bool ring_read(ring *r, int fd, void *buffer, unsigned len, off_t offset, int index, uint64_t tag);
+
+// Submits queued reads and waits for at least wait completions, returns false on error
+bool ring_submit(ring *r, unsigned wait);
+
+// Pops a completion if there is one, giving its tag and result (bytes read or -errno)
+bool ring_reap(ring *r, uint64_t *tag, int *result);
+
+// Tears a ring down
+void ring_free(ring *r);
+
+#endif // URING_H
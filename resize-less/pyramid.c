@@ -0,0 +1,236 @@
+// Image pyramids: every power-of-two downscale of a BMP in one pass
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PYRAMID_X86
+#endif
+
+#include "pyramid.h"
+
+// Most levels a pyramid can have (sides are at most 2^24)
+#define MAX_LEVELS 26
+
+// Linear light is kept in 14 bits, so four samples still sum inside 16
+#define LINEAR_BITS 14
+#define LINEAR_SIZE (1 << LINEAR_BITS)
+
+// One level of a pyramid: its file, the next row of it to write, and whether 2 rows (and columns)
+// of the level above make one of it, with the first of a pair held until the second arrives
+typedef struct
+{
+    bitmap out;
+    int row;
+    int sx;
+    int sy;
+    BYTE *pending;
+    bool held;
+}
+level;
+
+// sRGB bytes to linear light, and back
+static uint16_t to_linear[256];
+static BYTE from_linear[LINEAR_SIZE];
+
+// Fills the gamma tables
+static void build_gamma(void)
+{
+    for (int v = 0; v < 256; v++)
+    {
+        double c = v / 255.0;
+        c = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+        to_linear[v] = lround(c * (LINEAR_SIZE - 1));
+    }
+    for (int l = 0; l < LINEAR_SIZE; l++)
+    {
+        double c = (double) l / (LINEAR_SIZE - 1);
+        c = c <= 0.0031308 ? c * 12.92 : 1.055 * pow(c, 1 / 2.4) - 0.055;
+        from_linear[l] = lround(c * 255);
+    }
+}
+
+// Averages the sx by 2 blocks of rows a and b (the same row if the level above is one row high)
+// into width pixels of out, one pixel at a time starting from pixel from; alpha is averaged as is
+static void reduce_scalar(const BYTE *a, const BYTE *b, BYTE *out, int from, int width, int sx, int bytes,
+                          bool gamma)
+{
+    for (int j = from; j < width; j++)
+    {
+        const BYTE *a0 = &a[j * sx * bytes], *a1 = &a0[(sx - 1) * bytes];
+        const BYTE *b0 = &b[j * sx * bytes], *b1 = &b0[(sx - 1) * bytes];
+        for (int c = 0; c < bytes; c++)
+        {
+            if (gamma && c < 3)
+            {
+                int sum = to_linear[a0[c]] + to_linear[a1[c]] + to_linear[b0[c]] + to_linear[b1[c]];
+                out[j * bytes + c] = from_linear[(sum + 2) >> 2];
+            }
+            else
+            {
+                out[j * bytes + c] = (a0[c] + a1[c] + b0[c] + b1[c] + 2) >> 2;
+            }
+        }
+    }
+}
+
+#ifdef PYRAMID_X86
+// Averages pairs of the four pixels (one per 32-bit lane) in x and y into two pixels, in the low 8 bytes
+__attribute__((target("ssse3")))
+static __m128i reduce_lanes(__m128i x, __m128i y)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(y, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(y, zero));
+    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+    return _mm_packus_epi16(sum, sum);
+}
+
+// Averages 2x2 blocks four output pixels at a time, returning how many were done. Packed 24-bit
+// pixels are shuffled out to one per lane first; their second load runs 4 bytes past the 8 pixels,
+// so that's only done while the row has them
+__attribute__((target("ssse3")))
+static int reduce_ssse3(const BYTE *a, const BYTE *b, BYTE *out, int width, int in_width, int bytes)
+{
+    int j = 0;
+    if (bytes == 4)
+    {
+        for (; j + 4 <= width; j += 4)
+        {
+            __m128i lo = reduce_lanes(_mm_loadu_si128((__m128i *) &a[j * 8]), _mm_loadu_si128((__m128i *) &b[j * 8]));
+            __m128i hi = reduce_lanes(_mm_loadu_si128((__m128i *) &a[j * 8 + 16]),
+                                      _mm_loadu_si128((__m128i *) &b[j * 8 + 16]));
+            _mm_storeu_si128((__m128i *) &out[j * 4], _mm_unpacklo_epi64(lo, hi));
+        }
+        return j;
+    }
+
+    const __m128i unpack = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (; j + 4 <= width && j * 6 + 28 <= in_width * 3; j += 4)
+    {
+        const BYTE *pa = &a[j * 6], *pb = &b[j * 6];
+        __m128i lo = reduce_lanes(_mm_shuffle_epi8(_mm_loadu_si128((__m128i *) pa), unpack),
+                                  _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) pb), unpack));
+        __m128i hi = reduce_lanes(_mm_shuffle_epi8(_mm_loadu_si128((__m128i *) &pa[12]), unpack),
+                                  _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) &pb[12]), unpack));
+
+        //exactly 12 bytes go out, so nothing past the row is touched
+        __m128i pixels = _mm_shuffle_epi8(_mm_unpacklo_epi64(lo, hi), pack);
+        _mm_storel_epi64((__m128i *) &out[j * 3], pixels);
+        int last = _mm_cvtsi128_si32(_mm_srli_si128(pixels, 8));
+        memcpy(&out[j * 3 + 8], &last, 4);
+    }
+    return j;
+}
+#endif
+
+// Averages blocks of rows a and b into a row of l
+static void reduce(const level *l, const BYTE *a, const BYTE *b, int in_width, bool gamma)
+{
+    BYTE *out = bmp_row(&l->out, l->row);
+    int done = 0;
+#ifdef PYRAMID_X86
+    if (l->sx == 2 && !gamma && __builtin_cpu_supports("ssse3"))
+    {
+        done = reduce_ssse3(a, b, out, l->out.width, in_width, l->out.bytes);
+    }
+#endif
+    reduce_scalar(a, b, out, done, l->out.width, l->sx, l->out.bytes, gamma);
+}
+
+// Hands a row of the level above (or of the image, for the first) to level k, which holds it until its pair
+// arrives, writes their average, and hands that on in turn. A last unpaired row of an odd height is dropped
+static void push_row(level *levels, int k, int count, const BYTE *row, int in_width, bool gamma)
+{
+    level *l = &levels[k];
+    if (l->sy == 2 && !l->held)
+    {
+        memcpy(l->pending, row, (size_t) in_width * l->out.bytes);
+        l->held = true;
+        return;
+    }
+    reduce(l, l->sy == 2 ? l->pending : row, row, in_width, gamma);
+    l->held = false;
+    const BYTE *written = bmp_row(&l->out, l->row++);
+    if (k + 1 < count)
+    {
+        push_row(levels, k + 1, count, written, l->out.width, gamma);
+    }
+}
+
+// Writes each power-of-two downscale of in to numbered files
+int write_pyramid(const bitmap *in, const char *outfile, bool gamma)
+{
+    static bool built = false;
+    if (gamma && !built)
+    {
+        build_gamma();
+        built = true;
+    }
+
+    //out.bmp's levels are out-1.bmp, out-2.bmp, ...
+    size_t stem = strlen(outfile);
+    if (stem > 4 && strcmp(outfile + stem - 4, ".bmp") == 0)
+    {
+        stem -= 4;
+    }
+
+    //each level halves whichever sides are still longer than a pixel
+    level levels[MAX_LEVELS];
+    int count = 0;
+    bool ok = true;
+    for (int width = in->width, height = in->height; ok && (width > 1 || height > 1); count++)
+    {
+        level *l = &levels[count];
+        memset(l, 0, sizeof(level));
+        l->sx = width > 1 ? 2 : 1;
+        l->sy = height > 1 ? 2 : 1;
+        l->pending = malloc((size_t) width * in->bytes);
+        width /= l->sx;
+        height /= l->sy;
+
+        char *name = NULL;
+        if (asprintf(&name, "%.*s-%i.bmp", (int) stem, outfile, count + 1) < 0 || l->pending == NULL)
+        {
+            free(name);
+            free(l->pending);
+            fprintf(stderr, "Not enough memory.\n");
+            ok = false;
+            break;
+        }
+        if (bmp_create(&l->out, name, width, height, in->top_down, in->bytes, in) != BMP_OK)
+        {
+            fprintf(stderr, "Could not create %s.\n", name);
+            free(name);
+            free(l->pending);
+            ok = false;
+            break;
+        }
+        free(name);
+    }
+
+    //the image streams through once, every level filling as its rows pair up
+    for (int i = 0; ok && count > 0 && i < in->height; i++)
+    {
+        push_row(levels, 0, count, bmp_row(in, i), in->width, gamma);
+    }
+
+    for (int k = 0; k < count; k++)
+    {
+        free(levels[k].pending);
+        if (!bmp_close(&levels[k].out) && ok)
+        {
+            fprintf(stderr, "Could not write level %i.\n", k + 1);
+            ok = false;
+        }
+    }
+    return ok ? count : -1;
+}
@@ -0,0 +1,16 @@
+// Image pyramids: every power-of-two downscale of a BMP in one pass
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <stdbool.h>
+
+#include "bmpio.h"
+
+// Writes each power-of-two downscale of in, down to 1x1, to files numbered after outfile
+// (out.bmp becomes out-1.bmp at half size, out-2.bmp at a quarter, and so on). Each level averages
+// 2x2 blocks of the one above, in linear light if gamma, as rows of in stream through.
+// Returns the number of levels written, or -1 if one couldn't be (having said why)
+int write_pyramid(const bitmap *in, const char *outfile, bool gamma);
+
+#endif // PYRAMID_H
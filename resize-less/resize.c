@@ -1,133 +1,220 @@
-// Copies a BMP file
+// Resizes a BMP file
 
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bands.h"
+#include "bmpio.h"
+#include "pyramid.h"
+#include "scale.h"
+
+// How to run resize
+const char *USAGE = "Usage: ./resize [-f nearest|bilinear|bicubic|lanczos] [-j threads] factor[xfactor] infile outfile\n"
+                    "       ./resize -p [-g] infile outfile\n";
+
+// Repeats every pixel n times in both directions, exactly as resize always has
+void resize_nearest(int n, const bitmap *in, bitmap *out);
+
+// Resamples in into out with filter f, rendering bands of rows on threads
+bool resize_filtered(filter f, int threads, const bitmap *in, bitmap *out);
 
-#include "bmp.h"
+// Writes every power-of-two downscale of infile to files numbered after outfile
+int resize_pyramid(char *infile, char *outfile, bool gamma);
 
 int main(int argc, char *argv[])
 {
+    //-f picks the resampling filter, which also allows whole-number factors to be filtered,
+    //-j renders bands of rows on threads (repeating pixels with nearest unless -f says otherwise),
+    //-p writes every power-of-two downscale instead, -g averaging them in linear light
+    filter f = BILINEAR;
+    bool filtered = false;
+    int threads = 0;
+    bool pyramid = false;
+    bool gamma = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:gj:p")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                pyramid = true;
+                break;
+            case 'g':
+                gamma = true;
+                break;
+            case 'f':
+                if (parse_filter(optarg, &f))
+                {
+                    filtered = true;
+                    break;
+                }
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+            case 'j':
+                threads = atoi(optarg);
+                if (threads > 0)
+                {
+                    break;
+                }
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+            default:
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+        }
+    }
+
     // ensure proper usage
-    if (argc != 4)
+    if (pyramid ? argc - optind != 2 || filtered || threads > 0 : argc - optind != 3 || gamma)
     {
-        fprintf(stderr, "Usage: ./resize REZISEVALUE(n) infile outfile\n");
+        fprintf(stderr, "%s", USAGE);
         return 1;
     }
-    //resize factor
-    int n = atoi(argv[1]);
+    if (pyramid)
+    {
+        return resize_pyramid(argv[optind], argv[optind + 1], gamma);
+    }
 
+    //resize factor, either one for both directions or widthxheight, e.g. 2.5 or 0.5x0.75
+    double fx, fy;
+    if (!parse_factor(argv[optind], &fx, &fy))
+    {
+        fprintf(stderr, "%s", USAGE);
+        return 1;
+    }
+
+    //a single whole number keeps the original pixel-repeating resize, which nearest matches exactly
+    int n = (int) fx;
+    bool whole = fx == fy && n == fx;
+    if (!filtered && whole && threads > 0)
+    {
+        f = NEAREST;
+    }
+    filtered = filtered || !whole || threads > 0;
 
     // remember filenames
-    char *infile = argv[2];
-    char *outfile = argv[3];
+    char *infile = argv[optind + 1];
+    char *outfile = argv[optind + 2];
 
-    // open input file
-    FILE *inptr = fopen(infile, "r");
-    if (inptr == NULL)
+    // map infile, ensuring it's an uncompressed 24- or 32-bit BMP
+    bitmap in;
+    bmp_status status = bmp_open(&in, infile);
+    if (status == BMP_UNSUPPORTED)
+    {
+        fprintf(stderr, "Unsupported file format.\n");
+        return 4;
+    }
+    if (status != BMP_OK)
     {
         fprintf(stderr, "Could not open %s.\n", infile);
         return 2;
     }
 
-    // open output file
-    FILE *outptr = fopen(outfile, "w");
-    if (outptr == NULL)
+    //rows keep the order they're stored in, top-down or bottom-up
+    long width = filtered ? scaled_size(in.width, fx) : (long) in.width * n;
+    long height = filtered ? scaled_size(in.height, fy) : (long) in.height * n;
+    bitmap out;
+    status = bmp_create(&out, outfile, width > INT_MAX ? INT_MAX : width, height > INT_MAX ? INT_MAX : height,
+                        in.top_down, in.bytes, &in);
+    if (status == BMP_UNSUPPORTED)
     {
-        fclose(inptr);
+        bmp_close(&in);
+        fprintf(stderr, "%s would be too large for a BMP.\n", outfile);
+        return 4;
+    }
+    if (status != BMP_OK)
+    {
+        bmp_close(&in);
         fprintf(stderr, "Could not create %s.\n", outfile);
         return 3;
     }
 
-    // read infile's BITMAPFILEHEADER
-    BITMAPFILEHEADER bf;
-    fread(&bf, sizeof(BITMAPFILEHEADER), 1, inptr);
-
-    // read infile's BITMAPINFOHEADER
-    BITMAPINFOHEADER bi;
-    fread(&bi, sizeof(BITMAPINFOHEADER), 1, inptr);
-
-    // ensure infile is (likely) a 24-bit uncompressed BMP 4.0
-    if (bf.bfType != 0x4d42 || bf.bfOffBits != 54 || bi.biSize != 40 ||
-        bi.biBitCount != 24 || bi.biCompression != 0)
+    bool ok = true;
+    if (filtered)
     {
-        fclose(outptr);
-        fclose(inptr);
-        fprintf(stderr, "Unsupported file format.\n");
-        return 4;
+        ok = resize_filtered(f, threads, &in, &out);
+    }
+    else
+    {
+        resize_nearest(n, &in, &out);
     }
 
-    // determine padding for scanlines
-    int padding = (4 - (bi.biWidth * sizeof(RGBTRIPLE)) % 4) % 4;
-
-    //before writing modify the header
-
-
-    //New values to old values
-    int old_biWidth = bi.biWidth;
-    int old_biHeight = bi.biHeight;
-    int old_padding = (4 - (bi.biWidth * sizeof(RGBTRIPLE)) % 4) % 4;
-
-
-    bi.biWidth = bi.biWidth * n;
-    bi.biHeight = bi.biHeight * n;
-    int new_padding =  (4 - (bi.biWidth * sizeof(RGBTRIPLE)) % 4) % 4;
-
-
-    bi.biSizeImage = ((bi.biWidth * sizeof(RGBTRIPLE)) + new_padding) * abs(bi.biHeight);
-    bf.bfSize = bi.biSizeImage + sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
-
-    // write outfile's BITMAPFILEHEADER
-    fwrite(&bf, sizeof(BITMAPFILEHEADER), 1, outptr);
-
-    // write outfile's BITMAPINFOHEADER
-    fwrite(&bi, sizeof(BITMAPINFOHEADER), 1, outptr);
-
+    bmp_close(&in);
+    if (!bmp_close(&out) && ok)
+    {
+        fprintf(stderr, "Could not write %s.\n", outfile);
+        return 3;
+    }
+    return ok ? 0 : 5;
+}
 
+// Repeats every pixel n times in both directions
+void resize_nearest(int n, const bitmap *in, bitmap *out)
+{
     // iterate over infile's scanlines
-    for (int i = 0, biHeight = abs(old_biHeight); i < biHeight; i++)
+    for (int i = 0; i < in->height; i++)
     {
-        for (int rows = 0; rows < n; rows ++)
+        // repeat each pixel n times across the first of its n rows; its padding stays zeroed
+        const unsigned char *pixel = bmp_row(in, i);
+        unsigned char *scaled = bmp_row(out, i * n);
+        for (int j = 0; j < in->width; j++, pixel += in->bytes)
         {
-            // iterate over pixels in scanline
-            for (int j = 0; j < old_biWidth; j++)
-            {
-                for (int COLS = 0; COLS < n; COLS++)
-                {
-                    // temporary storage
-                    RGBTRIPLE triple;
-
-                    // read RGB triple from infile
-                    fread(&triple, sizeof(RGBTRIPLE), 1, inptr);
-
-                    // write RGB triple to outfile
-                    fwrite(&triple, sizeof(RGBTRIPLE), 1, outptr);
-
-                    // move file pointer back one pixel if not at last pixel
-                    if (COLS != (n-1))
-                        fseek(inptr, -sizeof(RGBTRIPLE), SEEK_CUR);
-                }
-            }
-
-            // skip over padding, if any
-            fseek(inptr, old_padding, SEEK_CUR);
-
-            // then add it back (to demonstrate how)
-            for (int l = 0; l < new_padding; l++)
+            for (int COLS = 0; COLS < n; COLS++, scaled += out->bytes)
             {
-                fputc(0x00, outptr);
+                memcpy(scaled, pixel, in->bytes);
             }
+        }
 
-            // move file pointer back to the beginning of the row if not at last row
-            if (rows != ( n - 1))
-                fseek(inptr, (-sizeof(RGBTRIPLE) * old_biWidth) - old_padding , SEEK_CUR);
+        // then copy that row to the rest
+        for (int rows = 1; rows < n; rows++)
+        {
+            memcpy(bmp_row(out, i * n + rows), bmp_row(out, i * n), out->stride);
         }
     }
+}
 
-    // close infile
-    fclose(inptr);
-
-    // close outfile
-    fclose(outptr);
+// Resamples in into out with filter f, rendering bands of rows on threads
+bool resize_filtered(filter f, int threads, const bitmap *in, bitmap *out)
+{
+    resample r = {.in = in, .out = out};
+    if (!make_weights(&r.x, in->width, out->width, f) || !make_weights(&r.y, in->height, out->height, f))
+    {
+        free_weights(&r.x);
+        fprintf(stderr, "Not enough memory.\n");
+        return false;
+    }
+    bool ok = resample_bands(&r, threads);
+    free_weights(&r.x);
+    free_weights(&r.y);
+    if (!ok)
+    {
+        fprintf(stderr, "Not enough memory.\n");
+    }
+    return ok;
+}
 
-    return 0;
+// Writes every power-of-two downscale of infile to files numbered after outfile
+int resize_pyramid(char *infile, char *outfile, bool gamma)
+{
+    bitmap in;
+    bmp_status status = bmp_open(&in, infile);
+    if (status == BMP_UNSUPPORTED)
+    {
+        fprintf(stderr, "Unsupported file format.\n");
+        return 4;
+    }
+    if (status != BMP_OK)
+    {
+        fprintf(stderr, "Could not open %s.\n", infile);
+        return 2;
+    }
+    int levels = write_pyramid(&in, outfile, gamma);
+    bmp_close(&in);
+    return levels < 0 ? 3 : 0;
 }
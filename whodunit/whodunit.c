@@ -1,111 +1,179 @@
-#include <cs50.h>
-#include <stdio.h>
-
+// Filters a BMP file, by default revealing the message hidden in its red noise
 
-// Copies a BMP file
+#define _GNU_SOURCE
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "analyze.h"
+#include "bmpio.h"
+#include "filters.h"
+
+// How to run whodunit
+const char *USAGE = "Usage: whodunit [-f filter]... infile outfile\n"
+                    "       whodunit -a [-c RRGGBB]... [-j threads] infile [stats.json]\n";
 
-#include "bmp.h"
+// Writes infile's per-channel histograms, min, max and mean, and counts of colors, as JSON to statsfile (or stdout)
+int analyze_file(char *infile, char *statsfile, int colors, const DWORD color[], int threads);
 
 int main(int argc, char *argv[])
 {
+    //each -f adds a filter (reveal, grayscale, threshold[=level], swap=order, tint=RRGGBB), run in order;
+    //with none, the message is revealed.
+    //-a analyzes infile instead, counting pixels of each -c color (by default the red noise and white
+    //background reveal removes) with -j threads
+    pixel_filter filter;
+    filter_init(&filter);
+    bool analyzing = false;
+    DWORD colors[MAX_COLORS];
+    int ncolors = 0;
+    int threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "ac:f:j:")) != -1)
+    {
+        bool ok = true;
+        char *end;
+        switch (opt)
+        {
+            case 'a':
+                analyzing = true;
+                break;
+            case 'c':
+                ok = ncolors < MAX_COLORS && strlen(optarg) == 6;
+                if (ok)
+                {
+                    colors[ncolors++] = strtoul(optarg, &end, 16);
+                    ok = *end == '\0';
+                }
+                break;
+            case 'f':
+                ok = add_filter(&filter, optarg);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                ok = threads > 0;
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok)
+        {
+            fprintf(stderr, "%s", USAGE);
+            return 1;
+        }
+    }
+
     // Ensure proper usage
-    if (argc != 3)
+    if (analyzing ? filter.count > 0 || argc - optind < 1 || argc - optind > 2 : argc - optind != 2 || ncolors > 0)
     {
-        fprintf(stderr, "Usage: whodunit infile outfile\n");
+        fprintf(stderr, "%s", USAGE);
         return 1;
     }
+    if (analyzing)
+    {
+        if (ncolors == 0)
+        {
+            colors[ncolors++] = 0xff0000;
+            colors[ncolors++] = 0xffffff;
+        }
+        return analyze_file(argv[optind], argc - optind == 2 ? argv[optind + 1] : NULL, ncolors, colors, threads);
+    }
+    if (filter.count == 0)
+    {
+        add_filter(&filter, "reveal");
+    }
 
     // Remember filenames
-    char *infile = argv[1];
-    char *outfile = argv[2];
+    char *infile = argv[optind];
+    char *outfile = argv[optind + 1];
 
-    // Open input file
-    FILE *inptr = fopen(infile, "r");
-    if (inptr == NULL)
+    // Map infile, ensuring it's an uncompressed 24- or 32-bit BMP
+    bitmap in;
+    bmp_status status = bmp_open(&in, infile);
+    if (status == BMP_UNSUPPORTED)
+    {
+        fprintf(stderr, "Unsupported file format.\n");
+        return 4;
+    }
+    if (status != BMP_OK)
     {
         fprintf(stderr, "Could not open %s.\n", infile);
         return 2;
     }
 
-    // Open output file
-    FILE *outptr = fopen(outfile, "w");
-    if (outptr == NULL)
+    // Create outfile the same size and layout, with infile's headers
+    bitmap out;
+    if (bmp_create(&out, outfile, in.width, in.height, in.top_down, in.bytes, &in) != BMP_OK)
     {
-        fclose(inptr);
+        bmp_close(&in);
         fprintf(stderr, "Could not create %s.\n", outfile);
         return 3;
     }
 
-    // Read infile's BITMAPFILEHEADER
-    BITMAPFILEHEADER bf;
-    fread(&bf, sizeof(BITMAPFILEHEADER), 1, inptr);
-
-    // Read infile's BITMAPINFOHEADER
-    BITMAPINFOHEADER bi;
-    fread(&bi, sizeof(BITMAPINFOHEADER), 1, inptr);
-
-    // Ensure infile is (likely) a 24-bit uncompressed BMP 4.0
-    if (bf.bfType != 0x4d42 || bf.bfOffBits != 54 || bi.biSize != 40 ||
-        bi.biBitCount != 24 || bi.biCompression != 0)
+    // Filter infile's scanlines a whole row at a time, leaving outfile's padding zeroed
+    for (int i = 0; i < in.height; i++)
     {
-        fclose(outptr);
-        fclose(inptr);
-        fprintf(stderr, "Unsupported file format.\n");
-        return 4;
+        filter_row(&filter, bmp_row(&in, i), bmp_row(&out, i), in.width, in.bytes);
     }
 
-    // Write outfile's BITMAPFILEHEADER
-    fwrite(&bf, sizeof(BITMAPFILEHEADER), 1, outptr);
-
-    // Write outfile's BITMAPINFOHEADER
-    fwrite(&bi, sizeof(BITMAPINFOHEADER), 1, outptr);
-
-    // Determine padding for scanlines
-    int padding = (4 - (bi.biWidth * sizeof(RGBTRIPLE)) % 4) % 4;
+    // Unmap infile
+    bmp_close(&in);
 
-    // Iterate over infile's scanlines
-    for (int i = 0, biHeight = abs(bi.biHeight); i < biHeight; i++)
+    // Unmap outfile, saving it
+    if (!bmp_close(&out))
     {
-        // Iterate over pixels in scanline
-        for (int j = 0; j < bi.biWidth; j++)
-        {
-            // Temporary storage
-            RGBTRIPLE triple;
-
-            // Read RGB triple from infile
-            fread(&triple, sizeof(RGBTRIPLE), 1, inptr);
-
-            //implementing filter
-            if ((triple.rgbtRed == 0xff && triple.rgbtBlue == 0x00 && triple.rgbtGreen == 0x00) || (triple.rgbtRed == 0xff
-                    && triple.rgbtBlue == 0xff && triple.rgbtGreen == 0xff))
-            {
-                triple.rgbtRed = 0x00;
-                triple.rgbtBlue = 0x00;
-                triple.rgbtGreen = 0x00;
-            }
-            // Write RGB triple to outfile
-            fwrite(&triple, sizeof(RGBTRIPLE), 1, outptr);
-        }
+        fprintf(stderr, "Could not write %s.\n", outfile);
+        return 3;
+    }
 
-        // Skip over padding, if any
-        fseek(inptr, padding, SEEK_CUR);
+    // success
+    return 0;
+}
 
-        // Then add it back (to demonstrate how)
-        for (int k = 0; k < padding; k++)
-        {
-            fputc(0x00, outptr);
-        }
+// Writes infile's statistics as JSON to statsfile (or stdout)
+int analyze_file(char *infile, char *statsfile, int colors, const DWORD color[], int threads)
+{
+    // Map infile, ensuring it's an uncompressed 24- or 32-bit BMP
+    bitmap in;
+    bmp_status status = bmp_open(&in, infile);
+    if (status == BMP_UNSUPPORTED)
+    {
+        fprintf(stderr, "Unsupported file format.\n");
+        return 4;
+    }
+    if (status != BMP_OK)
+    {
+        fprintf(stderr, "Could not open %s.\n", infile);
+        return 2;
     }
 
-    // Close infile
-    fclose(inptr);
-
-    // Close outfile
-    fclose(outptr);
+    //one pass over every pixel, on threads
+    analysis a;
+    analysis_init(&a, colors, color);
+    if (!analyze(&in, &a, threads))
+    {
+        bmp_close(&in);
+        fprintf(stderr, "Not enough memory.\n");
+        return 5;
+    }
 
-    // success
+    FILE *out = statsfile ? fopen(statsfile, "w") : stdout;
+    if (out == NULL)
+    {
+        bmp_close(&in);
+        fprintf(stderr, "Could not create %s.\n", statsfile);
+        return 3;
+    }
+    analysis_json(out, &in, &a);
+    bmp_close(&in);
+    if (out != stdout && fclose(out) != 0)
+    {
+        fprintf(stderr, "Could not write %s.\n", statsfile);
+        return 3;
+    }
     return 0;
 }